@@ -0,0 +1,234 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <alsa/asoundlib.h>
+#include <glib-object.h>
+
+#include "alsa.h"
+#include "samples.h"
+
+#define BENCH_PCM "hmbench"
+#define BENCH_ELEMENT "HM Bench"
+#define BENCH_CONTROL BENCH_ELEMENT " Playback Volume"
+#define BENCH_CARD_ENV "HM_BENCH_CARD"
+#define SWITCHES 1000
+#define EXIT_SKIP 77
+
+/* Count allocations by wrapping glibc allocator */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static guint64 allocations;
+
+void *
+malloc (size_t size)
+{
+    allocations++;
+
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+        size_t size)
+{
+    allocations++;
+
+    return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+    allocations++;
+
+    return __libc_realloc (ptr, size);
+}
+
+/* Volume switch as done before mixers were kept open */
+static int
+open_per_call_switch (const char *card,
+                      long       *saved,
+                      long        volume)
+{
+    snd_mixer_t *handle;
+    snd_mixer_selem_id_t *sid;
+    snd_mixer_elem_t *elem;
+    int err;
+
+    if ((err = snd_mixer_open (&handle, 0)) < 0)
+        return err;
+
+    if ((err = snd_mixer_attach (handle, card)) < 0 ||
+            (err = snd_mixer_selem_register (handle, NULL, NULL)) < 0 ||
+            (err = snd_mixer_load (handle)) < 0) {
+        snd_mixer_close (handle);
+        return err;
+    }
+
+    snd_mixer_selem_id_alloca (&sid);
+    snd_mixer_selem_id_set_index (sid, 0);
+    snd_mixer_selem_id_set_name (sid, BENCH_ELEMENT);
+    elem = snd_mixer_find_selem (handle, sid);
+    if (elem == NULL) {
+        snd_mixer_close (handle);
+        return -ENOENT;
+    }
+
+    snd_mixer_selem_get_playback_volume (elem, 0, saved);
+
+    if (volume != -1)
+        snd_mixer_selem_set_playback_volume_all (elem, volume);
+
+    snd_mixer_close (handle);
+
+    return 0;
+}
+
+static void
+report (const char *name,
+        GArray     *latencies,
+        guint64     count)
+{
+    samples_sort (latencies);
+
+    g_print (
+        "%-14s %5u switches  p50 %" G_GINT64_FORMAT " p90 %" G_GINT64_FORMAT
+        " p99 %" G_GINT64_FORMAT " max %" G_GINT64_FORMAT " µs  "
+        "%.1f allocations/switch\n",
+        name,
+        latencies->len,
+        samples_percentile (latencies, 50),
+        samples_percentile (latencies, 90),
+        samples_percentile (latencies, 99),
+        samples_percentile (latencies, 100),
+        count / (gdouble) MAX (latencies->len, 1)
+    );
+}
+
+static void
+run_open_per_call (const char *card)
+{
+    GArray *latencies = samples_new ();
+    long volume = -1;
+    guint64 count = 0;
+    guint i;
+
+    for (i = 0; i < SWITCHES; i++) {
+        guint64 start_allocations = allocations;
+        gint64 start = g_get_monotonic_time ();
+        long saved;
+
+        open_per_call_switch (card, &saved, volume);
+
+        samples_add (latencies, g_get_monotonic_time () - start);
+        count += allocations - start_allocations;
+        volume = saved;
+    }
+
+    report ("open-per-call", latencies, count);
+    g_array_unref (latencies);
+}
+
+static void
+run_cached (const char *card)
+{
+    const char *elements[] = { BENCH_ELEMENT, NULL };
+    GArray *latencies = samples_new ();
+    Alsa *alsa;
+    guint64 count = 0;
+    guint i;
+
+    alsa = ALSA (g_object_new (
+        TYPE_ALSA,
+        "card", card,
+        "plug-elements", elements,
+        "unplug-elements", elements,
+        NULL
+    ));
+
+    /* Presets are known after a first round trip */
+    alsa_volume_switch (alsa, TRUE);
+    alsa_volume_switch (alsa, FALSE);
+
+    for (i = 0; i < SWITCHES; i++) {
+        guint64 start_allocations = allocations;
+        gint64 start = g_get_monotonic_time ();
+
+        alsa_volume_switch (alsa, i % 2 == 0);
+
+        samples_add (latencies, g_get_monotonic_time () - start);
+        count += allocations - start_allocations;
+
+        /* Mixer events are handled between switches, as in the daemon */
+        while (g_main_context_iteration (NULL, FALSE))
+            continue;
+    }
+
+    report ("cached", latencies, count);
+    g_array_unref (latencies);
+    g_object_unref (alsa);
+}
+
+/* Softvol controls are user controls, they outlive the PCM */
+static void
+remove_bench_control (const char *card)
+{
+    snd_ctl_t *ctl;
+    snd_ctl_elem_id_t *id;
+    int err;
+
+    if ((err = snd_ctl_open (&ctl, card, 0)) < 0) {
+        g_printerr ("Can't open control %s: %s\n", card, snd_strerror (err));
+        return;
+    }
+
+    snd_ctl_elem_id_alloca (&id);
+    snd_ctl_elem_id_set_interface (id, SND_CTL_ELEM_IFACE_MIXER);
+    snd_ctl_elem_id_set_name (id, BENCH_CONTROL);
+
+    if ((err = snd_ctl_elem_remove (ctl, id)) < 0)
+        g_printerr ("Can't remove %s: %s\n", BENCH_CONTROL, snd_strerror (err));
+
+    snd_ctl_close (ctl);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+    g_autofree char *card = NULL;
+    snd_pcm_t *pcm;
+    long saved;
+    int err;
+
+    card = g_strdup_printf (
+        "hw:%s", g_getenv (BENCH_CARD_ENV) ? g_getenv (BENCH_CARD_ENV) : "0"
+    );
+
+    /* Softvol adds its control to the card on first open */
+    if ((err = snd_pcm_open (&pcm, BENCH_PCM,
+                             SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+        g_printerr ("Can't open %s: %s\n", BENCH_PCM, snd_strerror (err));
+        return EXIT_SKIP;
+    }
+    snd_pcm_close (pcm);
+
+    if ((err = open_per_call_switch (card, &saved, -1)) < 0) {
+        g_printerr ("Can't open mixer %s: %s\n", card, snd_strerror (err));
+        remove_bench_control (card);
+        return EXIT_SKIP;
+    }
+
+    run_open_per_call (card);
+    run_cached (card);
+
+    remove_bench_control (card);
+
+    return EXIT_SUCCESS;
+}
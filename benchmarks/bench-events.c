@@ -0,0 +1,367 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include "events.h"
+#include "replay.h"
+#include "samples.h"
+
+#define WRITE_BATCH 64
+#define SESSION_CYCLES 1000
+#define STORM_COUNT 100
+#define STORM_BOUNCES 50
+#define STORM_DEBOUNCE 20
+
+typedef struct {
+    gboolean collect;
+    guint    edges;
+    guint    changes;
+    GArray  *latencies;
+} Results;
+
+static void
+on_headphone_edge (Events   *events,
+                   gboolean  state,
+                   gint64    timestamp,
+                   gpointer  user_data)
+{
+    Results *results = user_data;
+    gint64 latency = g_get_monotonic_time () - timestamp;
+
+    results->edges++;
+
+    if (results->collect)
+        samples_add (results->latencies, latency);
+}
+
+static void
+on_headphone_state_changed (Events   *events,
+                            gboolean  state,
+                            gpointer  user_data)
+{
+    Results *results = user_data;
+
+    results->changes++;
+}
+
+static Events *
+new_events (guint    debounce,
+            Results *results,
+            int     *write_fd)
+{
+    Events *events;
+    int fds[2];
+
+    if (pipe (fds) < 0 ||
+            !g_unix_set_fd_nonblocking (fds[0], TRUE, NULL) ||
+            !g_unix_set_fd_nonblocking (fds[1], TRUE, NULL))
+        g_error ("Can't create pipe");
+
+    events = EVENTS (
+        g_object_new (TYPE_EVENTS, "scan", FALSE, "debounce", debounce, NULL)
+    );
+    if (!events_add_fd (events, fds[0], "replay"))
+        g_error ("Can't watch replay pipe");
+
+    g_signal_connect (
+        events,
+        "headphone-edge",
+        G_CALLBACK (on_headphone_edge),
+        results
+    );
+    g_signal_connect (
+        events,
+        "headphone-state-changed",
+        G_CALLBACK (on_headphone_state_changed),
+        results
+    );
+
+    *write_fd = fds[1];
+
+    return events;
+}
+
+static void
+stamp_event (struct input_event *event,
+             ReplayRecord       *record)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    event->input_event_sec = now / G_USEC_PER_SEC;
+    event->input_event_usec = now % G_USEC_PER_SEC;
+    event->type = record->type;
+    event->code = record->code;
+    event->value = record->value;
+}
+
+static void
+drain (int write_fd)
+{
+    int pending;
+
+    while (ioctl (write_fd, FIONREAD, &pending) == 0 && pending > 0)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+static gboolean
+on_settled (gpointer user_data)
+{
+    g_main_loop_quit ((GMainLoop *) user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+settle (guint debounce)
+{
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+    g_timeout_add (debounce + 1, on_settled, loop);
+    g_main_loop_run (loop);
+    g_main_loop_unref (loop);
+}
+
+static void
+write_events (int                 write_fd,
+              struct input_event *events,
+              guint               count)
+{
+    while (write (write_fd, events, count * sizeof (*events)) < 0) {
+        if (errno != EAGAIN)
+            g_error ("Can't write replay pipe");
+        drain (write_fd);
+    }
+}
+
+/* Write records as fast as the pipe accepts them */
+static gdouble
+replay_burst (GArray *records,
+              guint   debounce)
+{
+    struct input_event events[WRITE_BATCH];
+    Results results = { 0 };
+    Events *self;
+    gint64 start;
+    guint count = 0;
+    guint i;
+    int write_fd;
+
+    self = new_events (debounce, &results, &write_fd);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < records->len; i++) {
+        stamp_event (
+            &events[count++], &g_array_index (records, ReplayRecord, i)
+        );
+        if (count == WRITE_BATCH) {
+            write_events (write_fd, events, count);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        write_events (write_fd, events, count);
+    drain (write_fd);
+
+    close (write_fd);
+    g_object_unref (self);
+
+    return records->len * (gdouble) G_USEC_PER_SEC /
+        MAX (g_get_monotonic_time () - start, 1);
+}
+
+/* Write one frame at a time and wait for it to be dispatched */
+static void
+replay_paced (GArray  *records,
+              guint    debounce,
+              Results *results)
+{
+    struct input_event events[WRITE_BATCH];
+    Events *self;
+    guint count = 0;
+    guint i;
+    int write_fd;
+
+    results->collect = TRUE;
+    self = new_events (debounce, results, &write_fd);
+
+    for (i = 0; i < records->len; i++) {
+        ReplayRecord *record = &g_array_index (records, ReplayRecord, i);
+
+        /* Let pending debounce expire like it would have when recorded */
+        if (debounce > 0 && record->delay >= debounce * 1000)
+            settle (debounce);
+
+        stamp_event (&events[count++], record);
+        if (count == WRITE_BATCH ||
+                (record->type == EV_SYN && record->code == SYN_REPORT)) {
+            write_events (write_fd, events, count);
+            drain (write_fd);
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        write_events (write_fd, events, count);
+        drain (write_fd);
+    }
+    if (debounce > 0)
+        settle (debounce);
+
+    close (write_fd);
+    g_object_unref (self);
+}
+
+static void
+run (const char *name,
+     GArray     *records,
+     guint       debounce)
+{
+    Results results = { 0 };
+    gdouble rate;
+
+    results.latencies = samples_new ();
+
+    rate = replay_burst (records, debounce);
+    replay_paced (records, debounce, &results);
+
+    samples_sort (results.latencies);
+
+    g_print (
+        "%-14s %7u events %10.0f events/s  "
+        "dispatch p50 %" G_GINT64_FORMAT " p90 %" G_GINT64_FORMAT
+        " p99 %" G_GINT64_FORMAT " max %" G_GINT64_FORMAT " µs  "
+        "edges %u changes %u\n",
+        name,
+        records->len,
+        rate,
+        samples_percentile (results.latencies, 50),
+        samples_percentile (results.latencies, 90),
+        samples_percentile (results.latencies, 99),
+        samples_percentile (results.latencies, 100),
+        results.edges,
+        results.changes
+    );
+
+    g_array_unref (results.latencies);
+}
+
+static void
+append_frame (GArray   *records,
+              guint32   delay,
+              gboolean  state)
+{
+    replay_append (records, delay, EV_SW, SW_HEADPHONE_INSERT, state);
+    replay_append (records, 0, EV_SYN, SYN_REPORT, 0);
+}
+
+/* Plug/unplug cycles half a second apart */
+static GArray *
+session_records (void)
+{
+    GArray *records = g_array_new (FALSE, FALSE, sizeof (ReplayRecord));
+    guint i;
+
+    for (i = 0; i < SESSION_CYCLES * 2; i++)
+        append_frame (records, 500000, i % 2 == 0);
+
+    return records;
+}
+
+/* Contact bounce: fast toggles settling on alternating states */
+static GArray *
+storm_records (void)
+{
+    GArray *records = g_array_new (FALSE, FALSE, sizeof (ReplayRecord));
+    guint i, j;
+
+    for (i = 0; i < STORM_COUNT; i++) {
+        gboolean settled = i % 2 == 0;
+
+        for (j = 0; j < STORM_BOUNCES; j++) {
+            append_frame (
+                records, j == 0 ? 500000 : 200, (j % 2 == 0) == settled
+            );
+        }
+        append_frame (records, 200, settled);
+    }
+
+    return records;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autofree gchar *capture = NULL;
+    g_autofree gchar *output = NULL;
+    GArray *records;
+    gint duration = 10;
+    gint debounce = 0;
+    gint i;
+    GOptionEntry main_entries[] = {
+        {"capture", 0, 0, G_OPTION_ARG_FILENAME, &capture, "Record events from an evdev node", "DEVICE"},
+        {"output", 0, 0, G_OPTION_ARG_FILENAME, &output, "Recording to write", "FILE"},
+        {"duration", 0, 0, G_OPTION_ARG_INT, &duration, "Capture duration in seconds", "SECONDS"},
+        {"debounce", 0, 0, G_OPTION_ARG_INT, &debounce, "Debounce used to replay recordings", "MS"},
+        {NULL}
+    };
+
+    context = g_option_context_new ("[RECORDING…] - replay evdev streams");
+    g_option_context_add_main_entries (context, main_entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (capture != NULL) {
+        if (output == NULL) {
+            g_printerr ("--capture needs --output\n");
+            return EXIT_FAILURE;
+        }
+
+        records = replay_capture (capture, MAX (duration, 1), &error);
+        if (records == NULL || !replay_save (output, records, &error)) {
+            g_printerr ("%s\n", error->message);
+            return EXIT_FAILURE;
+        }
+        g_print ("%u events recorded\n", records->len);
+        g_array_unref (records);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (argc > 1) {
+        for (i = 1; i < argc; i++) {
+            records = replay_load (argv[i], &error);
+            if (records == NULL) {
+                g_printerr ("%s\n", error->message);
+                return EXIT_FAILURE;
+            }
+            run (argv[i], records, MAX (debounce, 0));
+            g_array_unref (records);
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    records = session_records ();
+    run ("session", records, 0);
+    g_array_unref (records);
+
+    records = storm_records ();
+    run ("storm", records, 0);
+    run ("storm-deb", records, STORM_DEBOUNCE);
+    g_array_unref (records);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,531 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include "mpris.h"
+
+#define DBUS_PROPERTIES_INTERFACE       "org.freedesktop.DBus.Properties"
+#define DBUS_MPRIS_PATH                 "/org/mpris/MediaPlayer2"
+#define DBUS_MPRIS_PLAYER_INTERFACE     "org.mpris.MediaPlayer2.Player"
+#define DBUS_MPRIS_PREFIX               "org.mpris.MediaPlayer2."
+
+/* One player out of SLOW_RATIO replies after SLOW_REPLY ms */
+#define SLOW_RATIO 10
+#define SLOW_REPLY 100
+#define WAIT_TIMEOUT (30 * G_USEC_PER_SEC)
+
+/* Helper commands, one byte each on its stdin */
+#define COMMAND_RELEASE 'r'
+#define COMMAND_OWN 'o'
+/* Printed by helper once its players own their names */
+#define ACQUIRED_LINE "acquired\n"
+
+static const char player_xml[] =
+    "<node>"
+    "  <interface name='" DBUS_MPRIS_PLAYER_INTERFACE "'>"
+    "    <method name='Pause'/>"
+    "    <method name='Play'/>"
+    "    <property name='PlaybackStatus' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+typedef struct {
+    char            *name;
+    GDBusConnection *connection;
+    guint            owner_id;
+    guint            registration_id;
+    const char      *status;
+    gboolean         slow;
+} MockPlayer;
+
+/* Mock players, run by a helper process */
+typedef struct {
+    GDBusNodeInfo *node_info;
+    GPtrArray     *players;
+    GMainLoop     *loop;
+    guint          count;
+    guint          acquired;
+    gboolean       announced;
+} Players;
+
+typedef struct {
+    /* Helper running the mock players */
+    GPid           pid;
+    int            input;
+    int            output;
+
+    gint64         start;
+    gint64         elapsed;
+    gint64         slowest;
+    gboolean       finished;
+} Bench;
+
+static gboolean
+on_slow_reply (gpointer user_data)
+{
+    g_dbus_method_invocation_return_value (
+        G_DBUS_METHOD_INVOCATION (user_data), NULL
+    );
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+set_status (MockPlayer *player,
+            const char *status)
+{
+    GVariantBuilder changed;
+
+    player->status = status;
+
+    g_variant_builder_init (&changed, G_VARIANT_TYPE ("a{sv}"));
+    g_variant_builder_add (
+        &changed, "{sv}", "PlaybackStatus", g_variant_new_string (status)
+    );
+
+    g_dbus_connection_emit_signal (
+        player->connection,
+        NULL,
+        DBUS_MPRIS_PATH,
+        DBUS_PROPERTIES_INTERFACE,
+        "PropertiesChanged",
+        g_variant_new (
+            "(sa{sv}as)", DBUS_MPRIS_PLAYER_INTERFACE, &changed, NULL
+        ),
+        NULL
+    );
+}
+
+static void
+on_method_call (GDBusConnection       *connection,
+                const char            *sender,
+                const char            *object_path,
+                const char            *interface_name,
+                const char            *method_name,
+                GVariant              *parameters,
+                GDBusMethodInvocation *invocation,
+                gpointer               user_data)
+{
+    MockPlayer *player = user_data;
+
+    set_status (
+        player, g_strcmp0 (method_name, "Pause") == 0 ? "Paused" : "Playing"
+    );
+
+    if (player->slow)
+        g_timeout_add (SLOW_REPLY, on_slow_reply, invocation);
+    else
+        g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static GVariant *
+on_get_property (GDBusConnection  *connection,
+                 const char       *sender,
+                 const char       *object_path,
+                 const char       *interface_name,
+                 const char       *property_name,
+                 GError          **error,
+                 gpointer          user_data)
+{
+    MockPlayer *player = user_data;
+
+    return g_variant_new_string (player->status);
+}
+
+static const GDBusInterfaceVTable player_vtable = {
+    on_method_call,
+    on_get_property,
+    NULL
+};
+
+static void
+on_name_acquired (GDBusConnection *connection,
+                  const char      *name,
+                  gpointer         user_data)
+{
+    Players *players = user_data;
+
+    players->acquired++;
+
+    /* Benchmark waits for the first acquisition only */
+    if (players->acquired == players->count && !players->announced) {
+        players->announced = TRUE;
+        fputs (ACQUIRED_LINE, stdout);
+        fflush (stdout);
+    }
+}
+
+static void
+own_name (Players    *players,
+          MockPlayer *player)
+{
+    player->owner_id = g_bus_own_name_on_connection (
+        player->connection,
+        player->name,
+        G_BUS_NAME_OWNER_FLAGS_NONE,
+        on_name_acquired,
+        NULL,
+        players,
+        NULL
+    );
+}
+
+static void
+clear_player (MockPlayer *player)
+{
+    g_clear_handle_id (&player->owner_id, g_bus_unown_name);
+    g_dbus_connection_unregister_object (
+        player->connection, player->registration_id
+    );
+    g_dbus_connection_close_sync (player->connection, NULL, NULL);
+    g_object_unref (player->connection);
+    g_free (player->name);
+    g_free (player);
+}
+
+static MockPlayer *
+new_player (Players    *players,
+            const char *address,
+            guint       index)
+{
+    g_autoptr (GError) error = NULL;
+    MockPlayer *player = g_new0 (MockPlayer, 1);
+
+    player->name = g_strdup_printf ("%sbench%u", DBUS_MPRIS_PREFIX, index);
+    player->status = "Playing";
+    player->slow = index % SLOW_RATIO == SLOW_RATIO - 1;
+
+    player->connection = g_dbus_connection_new_for_address_sync (
+        address,
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+        NULL,
+        NULL,
+        &error
+    );
+    if (player->connection == NULL)
+        g_error ("Can't connect mock player: %s", error->message);
+
+    player->registration_id = g_dbus_connection_register_object (
+        player->connection,
+        DBUS_MPRIS_PATH,
+        players->node_info->interfaces[0],
+        &player_vtable,
+        player,
+        NULL,
+        &error
+    );
+    if (player->registration_id == 0)
+        g_error ("Can't register mock player: %s", error->message);
+
+    own_name (players, player);
+
+    return player;
+}
+
+static gboolean
+on_command (gint         fd,
+            GIOCondition condition,
+            gpointer     user_data)
+{
+    Players *players = user_data;
+    char command;
+    guint i;
+
+    /* Benchmark closed the pipe, it is done with us */
+    if (read (fd, &command, 1) != 1) {
+        g_main_loop_quit (players->loop);
+        return G_SOURCE_REMOVE;
+    }
+
+    for (i = 0; i < players->players->len; i++) {
+        MockPlayer *player = g_ptr_array_index (players->players, i);
+
+        if (command == COMMAND_RELEASE)
+            g_clear_handle_id (&player->owner_id, g_bus_unown_name);
+        else if (command == COMMAND_OWN && player->owner_id == 0)
+            own_name (players, player);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Helper main: own count names on address until stdin is closed */
+static void
+run_players (const char *address,
+             guint       count)
+{
+    Players players = { 0 };
+    guint i;
+
+    players.node_info = g_dbus_node_info_new_for_xml (player_xml, NULL);
+    players.players = g_ptr_array_new_with_free_func (
+        (GDestroyNotify) clear_player
+    );
+    players.loop = g_main_loop_new (NULL, FALSE);
+    players.count = count;
+
+    for (i = 0; i < count; i++)
+        g_ptr_array_add (players.players, new_player (&players, address, i));
+
+    g_unix_fd_add (STDIN_FILENO, G_IO_IN | G_IO_HUP, on_command, &players);
+    g_main_loop_run (players.loop);
+
+    g_ptr_array_unref (players.players);
+    g_main_loop_unref (players.loop);
+    g_dbus_node_info_unref (players.node_info);
+}
+
+/*
+ * Players run in their own process so their method handlers and GDBus
+ * worker don't share the threads of the Mpris under test
+ */
+static void
+spawn_players (Bench      *bench,
+               const char *address,
+               guint       count)
+{
+    g_autoptr (GError) error = NULL;
+    g_autofree char *count_arg = g_strdup_printf ("%u", count);
+    const char *argv[] = {
+        "/proc/self/exe",
+        "--players-address", address,
+        "--players", count_arg,
+        NULL
+    };
+    char line[sizeof (ACQUIRED_LINE)] = { 0 };
+    FILE *output;
+
+    if (!g_spawn_async_with_pipes (
+            NULL, (char **) argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+            NULL, NULL, &bench->pid, &bench->input, &bench->output, NULL,
+            &error))
+        g_error ("Can't spawn mock players: %s", error->message);
+
+    output = fdopen (bench->output, "r");
+    if (fgets (line, sizeof (line), output) == NULL ||
+            g_strcmp0 (line, ACQUIRED_LINE) != 0)
+        g_error ("Mock players didn't start");
+    fclose (output);
+}
+
+static void
+send_command (Bench *bench,
+              char   command)
+{
+    if (write (bench->input, &command, 1) != 1)
+        g_error ("Can't send command to mock players");
+}
+
+static void
+stop_players (Bench *bench)
+{
+    close (bench->input);
+    waitpid (bench->pid, NULL, 0);
+    g_spawn_close_pid (bench->pid);
+}
+
+static gboolean
+on_wakeup (gpointer user_data)
+{
+    return G_SOURCE_CONTINUE;
+}
+
+/* Iterate until get_count() reaches expected, returns elapsed µs */
+static gint64
+wait_count (guint  (*get_count) (gpointer),
+            gpointer data,
+            guint    expected)
+{
+    gint64 start = g_get_monotonic_time ();
+    guint wakeup_id = g_timeout_add (10, on_wakeup, NULL);
+
+    while (get_count (data) != expected) {
+        if (g_get_monotonic_time () - start > WAIT_TIMEOUT) {
+            g_printerr ("Timeout: %u, expected %u\n",
+                        get_count (data), expected);
+            break;
+        }
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    g_source_remove (wakeup_id);
+
+    return g_get_monotonic_time () - start;
+}
+
+static guint
+get_n_players (gpointer data)
+{
+    return mpris_get_n_players (MPRIS (data));
+}
+
+static guint
+get_n_playing (gpointer data)
+{
+    return mpris_get_n_playing (MPRIS (data));
+}
+
+static guint
+get_finished (gpointer data)
+{
+    return ((Bench *) data)->finished;
+}
+
+static void
+on_calls_finished (Mpris      *mpris,
+                   const char *method,
+                   guint       count,
+                   guint       failed,
+                   gint64      slowest,
+                   gpointer    user_data)
+{
+    Bench *bench = user_data;
+
+    bench->elapsed = g_get_monotonic_time () - bench->start;
+    bench->slowest = slowest;
+    bench->finished = TRUE;
+
+    if (failed > 0)
+        g_printerr ("%s: %u/%u calls failed\n", method, failed, count);
+}
+
+/* Time from call to last reply, in µs */
+static gint64
+fan_out (Bench *bench,
+         Mpris *mpris,
+         void  (*call) (Mpris *))
+{
+    bench->finished = FALSE;
+    bench->start = g_get_monotonic_time ();
+    call (mpris);
+    wait_count (get_finished, bench, TRUE);
+
+    return bench->elapsed;
+}
+
+static void
+run (Bench      *bench,
+     const char *address,
+     guint       count)
+{
+    Mpris *mpris;
+    gint64 discovery, release, acquire, pause, play;
+
+    spawn_players (bench, address, count);
+
+    /* Discovery: ListNames, then owner and status of every player */
+    discovery = g_get_monotonic_time ();
+    mpris = MPRIS (mpris_new ());
+    g_signal_connect (
+        mpris, "calls-finished", G_CALLBACK (on_calls_finished), bench
+    );
+    wait_count (get_n_playing, mpris, count);
+    discovery = g_get_monotonic_time () - discovery;
+
+    /* Churn: every player leaves then comes back */
+    send_command (bench, COMMAND_RELEASE);
+    release = wait_count (get_n_players, mpris, 0);
+
+    acquire = g_get_monotonic_time ();
+    send_command (bench, COMMAND_OWN);
+    wait_count (get_n_playing, mpris, count);
+    acquire = g_get_monotonic_time () - acquire;
+
+    pause = fan_out (bench, mpris, mpris_pause);
+    play = fan_out (bench, mpris, mpris_play);
+
+    g_print (
+        "%5u players  discovery %9.1f ms  "
+        "churn out %8.1f in %8.1f µs/player  "
+        "pause %8.1f ms  play %8.1f ms  slowest reply %8.1f ms\n",
+        count,
+        discovery / 1000.0,
+        release / (gdouble) count,
+        acquire / (gdouble) count,
+        pause / 1000.0,
+        play / 1000.0,
+        bench->slowest / 1000.0
+    );
+
+    g_object_unref (mpris);
+    stop_players (bench);
+}
+
+static void
+raise_fd_limit (void)
+{
+    struct rlimit limit;
+
+    /* One bus connection per mock player */
+    if (getrlimit (RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &limit);
+    }
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GTestDBus) test_bus = NULL;
+    GDBusConnection *session_bus;
+    const char *address;
+    g_autofree char *players_address = NULL;
+    Bench bench = { 0 };
+    gint max_players = 1000;
+    gint players = 0;
+    guint count;
+    GOptionEntry main_entries[] = {
+        {"max-players", 0, 0, G_OPTION_ARG_INT, &max_players, "Largest number of mock players", "COUNT"},
+        {"players-address", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &players_address, "Run mock players on bus", "ADDRESS"},
+        {"players", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &players, "Number of mock players", "COUNT"},
+        {NULL}
+    };
+
+    context = g_option_context_new ("- measure mpris scaling");
+    g_option_context_add_main_entries (context, main_entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    raise_fd_limit ();
+
+    if (players_address != NULL) {
+        run_players (players_address, MAX (players, 1));
+        return EXIT_SUCCESS;
+    }
+
+    /* Private bus, becomes the session bus of this process */
+    test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (test_bus);
+    address = g_test_dbus_get_bus_address (test_bus);
+
+    /* Keep the shared connection Mpris uses across runs */
+    session_bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+    if (session_bus == NULL) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    for (count = 1; count <= (guint) MAX (max_players, 1); count *= 10)
+        run (&bench, address, count);
+
+    g_object_unref (session_bus);
+
+    g_test_dbus_down (test_bus);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "samples.h"
+#include "spawn.h"
+
+#define NOTIFY_SOCKET_NAME "notify"
+#define READY_TIMEOUT (10 * G_USEC_PER_SEC)
+
+static gboolean
+run (const char  *daemon,
+     char       **envp,
+     int          fd,
+     gint64      *elapsed)
+{
+    gboolean ready;
+    gint64 start;
+    GPid pid;
+
+    start = g_get_monotonic_time ();
+
+    if (!spawn_daemon (daemon, envp, &pid))
+        return FALSE;
+
+    ready = spawn_wait_ready (fd, start + READY_TIMEOUT);
+    *elapsed = g_get_monotonic_time () - start;
+
+    spawn_stop (pid);
+
+    return ready;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GTestDBus) test_bus = NULL;
+    g_autofree char *runtime_dir = NULL;
+    g_autofree char *socket_path = NULL;
+    g_auto (GStrv) envp = NULL;
+    GArray *latencies;
+    gint runs = 20;
+    gint i;
+    int fd;
+    GOptionEntry main_entries[] = {
+        {"runs", 0, 0, G_OPTION_ARG_INT, &runs, "Number of daemon starts", "COUNT"},
+        {NULL}
+    };
+
+    context = g_option_context_new ("DAEMON SCHEMA_DIR - measure time to readiness");
+    g_option_context_add_main_entries (context, main_entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (argc != 3) {
+        g_printerr ("Usage: %s DAEMON SCHEMA_DIR\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    runtime_dir = g_dir_make_tmp ("hm-startup-XXXXXX", &error);
+    if (runtime_dir == NULL) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    socket_path = g_build_filename (runtime_dir, NOTIFY_SOCKET_NAME, NULL);
+    fd = spawn_listen (socket_path);
+    if (fd < 0) {
+        g_printerr ("Can't bind %s: %s\n", socket_path, g_strerror (errno));
+        spawn_remove_dir (runtime_dir);
+        return EXIT_FAILURE;
+    }
+
+    /* Private bus, exported to the daemon with the environment */
+    test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (test_bus);
+
+    envp = spawn_get_environ (runtime_dir, socket_path, argv[2], NULL);
+
+    latencies = samples_new ();
+
+    for (i = 0; i < MAX (runs, 1); i++) {
+        gint64 elapsed;
+
+        if (!run (argv[1], envp, fd, &elapsed)) {
+            g_printerr ("No READY=1 from %s\n", argv[1]);
+            break;
+        }
+
+        samples_add (latencies, elapsed);
+    }
+
+    g_test_dbus_down (test_bus);
+    close (fd);
+    spawn_remove_dir (runtime_dir);
+
+    if (latencies->len != (guint) MAX (runs, 1)) {
+        g_array_unref (latencies);
+        return EXIT_FAILURE;
+    }
+
+    samples_sort (latencies);
+    g_print (
+        "%u starts  p50 %" G_GINT64_FORMAT " p90 %" G_GINT64_FORMAT
+        " max %" G_GINT64_FORMAT " µs to READY=1\n",
+        latencies->len,
+        samples_percentile (latencies, 50),
+        samples_percentile (latencies, 90),
+        samples_percentile (latencies, 100)
+    );
+    g_array_unref (latencies);
+
+    return EXIT_SUCCESS;
+}
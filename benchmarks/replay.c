@@ -0,0 +1,242 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include <gio/gio.h>
+
+#include "replay.h"
+
+#define HEADER_SIZE 8
+#define RECORD_SIZE 12
+
+static guint32
+read_u32 (const guint8 *data)
+{
+    guint32 value;
+
+    memcpy (&value, data, sizeof (value));
+
+    return GUINT32_FROM_LE (value);
+}
+
+static guint16
+read_u16 (const guint8 *data)
+{
+    guint16 value;
+
+    memcpy (&value, data, sizeof (value));
+
+    return GUINT16_FROM_LE (value);
+}
+
+static void
+write_u32 (GByteArray *bytes,
+           guint32     value)
+{
+    value = GUINT32_TO_LE (value);
+    g_byte_array_append (bytes, (guint8 *) &value, sizeof (value));
+}
+
+static void
+write_u16 (GByteArray *bytes,
+           guint16     value)
+{
+    value = GUINT16_TO_LE (value);
+    g_byte_array_append (bytes, (guint8 *) &value, sizeof (value));
+}
+
+/**
+ * replay_append:
+ *
+ * Append a record to @records
+ *
+ * @records: a #GArray of #ReplayRecord
+ * @delay: delay from previous record in µs
+ * @type: event type
+ * @code: event code
+ * @value: event value
+ *
+ **/
+void
+replay_append (GArray  *records,
+               guint32  delay,
+               guint16  type,
+               guint16  code,
+               gint32   value)
+{
+    ReplayRecord record = { delay, type, code, value };
+
+    g_array_append_val (records, record);
+}
+
+/**
+ * replay_load:
+ *
+ * Load a recorded evdev stream
+ *
+ * @path: file to load
+ * @error: return location for a #GError
+ *
+ * Returns: (transfer full): a #GArray of #ReplayRecord or NULL
+ *
+ **/
+GArray *
+replay_load (const char  *path,
+             GError     **error)
+{
+    g_autofree gchar *contents = NULL;
+    const guint8 *data;
+    GArray *records;
+    gsize length;
+    gsize offset;
+
+    if (!g_file_get_contents (path, &contents, &length, error))
+        return NULL;
+
+    data = (const guint8 *) contents;
+
+    if (length < HEADER_SIZE ||
+            memcmp (data, REPLAY_MAGIC, 4) != 0 ||
+            read_u32 (data + 4) != REPLAY_VERSION ||
+            (length - HEADER_SIZE) % RECORD_SIZE != 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Not a version %d recording: %s", REPLAY_VERSION, path);
+        return NULL;
+    }
+
+    records = g_array_sized_new (
+        FALSE, FALSE, sizeof (ReplayRecord),
+        (length - HEADER_SIZE) / RECORD_SIZE
+    );
+
+    for (offset = HEADER_SIZE; offset < length; offset += RECORD_SIZE) {
+        replay_append (
+            records,
+            read_u32 (data + offset),
+            read_u16 (data + offset + 4),
+            read_u16 (data + offset + 6),
+            (gint32) read_u32 (data + offset + 8)
+        );
+    }
+
+    return records;
+}
+
+/**
+ * replay_save:
+ *
+ * Save a recorded evdev stream
+ *
+ * @path: file to write
+ * @records: a #GArray of #ReplayRecord
+ * @error: return location for a #GError
+ *
+ * Returns: TRUE on success
+ *
+ **/
+gboolean
+replay_save (const char  *path,
+             GArray      *records,
+             GError     **error)
+{
+    g_autoptr (GByteArray) bytes = NULL;
+    guint i;
+
+    bytes = g_byte_array_sized_new (
+        HEADER_SIZE + records->len * RECORD_SIZE
+    );
+    g_byte_array_append (bytes, (const guint8 *) REPLAY_MAGIC, 4);
+    write_u32 (bytes, REPLAY_VERSION);
+
+    for (i = 0; i < records->len; i++) {
+        ReplayRecord *record = &g_array_index (records, ReplayRecord, i);
+
+        write_u32 (bytes, record->delay);
+        write_u16 (bytes, record->type);
+        write_u16 (bytes, record->code);
+        write_u32 (bytes, (guint32) record->value);
+    }
+
+    return g_file_set_contents (
+        path, (const gchar *) bytes->data, bytes->len, error
+    );
+}
+
+/**
+ * replay_capture:
+ *
+ * Record events read from an evdev node
+ *
+ * @device: evdev node path
+ * @seconds: capture duration
+ * @error: return location for a #GError
+ *
+ * Returns: (transfer full): a #GArray of #ReplayRecord or NULL
+ *
+ **/
+GArray *
+replay_capture (const char  *device,
+                guint        seconds,
+                GError     **error)
+{
+    GArray *records;
+    gint64 deadline;
+    gint64 previous = -1;
+    int fd;
+
+    fd = open (device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                     "Can't open %s", device);
+        return NULL;
+    }
+
+    records = g_array_new (FALSE, FALSE, sizeof (ReplayRecord));
+    deadline = g_get_monotonic_time () + seconds * G_USEC_PER_SEC;
+
+    for (;;) {
+        struct input_event events[64];
+        struct pollfd pollfd = { fd, POLLIN, 0 };
+        gint64 timeout = deadline - g_get_monotonic_time ();
+        ssize_t len;
+        int i;
+
+        if (timeout <= 0)
+            break;
+
+        if (poll (&pollfd, 1, (int) (timeout / 1000) + 1) <= 0)
+            continue;
+
+        len = read (fd, events, sizeof (events));
+        if (len < 0 && errno == EAGAIN)
+            continue;
+        if (len <= 0)
+            break;
+
+        for (i = 0; i < len / (ssize_t) sizeof (struct input_event); i++) {
+            gint64 time = events[i].input_event_sec * G_USEC_PER_SEC +
+                          events[i].input_event_usec;
+            gint64 delay = previous < 0 ? 0 : time - previous;
+
+            replay_append (
+                records,
+                (guint32) CLAMP (delay, 0, G_MAXUINT32),
+                events[i].type,
+                events[i].code,
+                events[i].value
+            );
+            previous = time;
+        }
+    }
+
+    close (fd);
+
+    return records;
+}
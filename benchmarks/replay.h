@@ -0,0 +1,44 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Recorded evdev stream: "HMEV" magic, a little endian guint32 version,
+ * then one ReplayRecord per input_event. Records carry the delay from
+ * the previous one instead of absolute time, events are restamped when
+ * replayed.
+ */
+#define REPLAY_MAGIC "HMEV"
+#define REPLAY_VERSION 1
+
+typedef struct {
+    guint32 delay;
+    guint16 type;
+    guint16 code;
+    gint32  value;
+} ReplayRecord;
+
+GArray*         replay_load    (const char  *path,
+                                GError     **error);
+gboolean        replay_save    (const char  *path,
+                                GArray      *records,
+                                GError     **error);
+GArray*         replay_capture (const char  *device,
+                                guint        seconds,
+                                GError     **error);
+void            replay_append  (GArray      *records,
+                                guint32      delay,
+                                guint16      type,
+                                guint16      code,
+                                gint32       value);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include "samples.h"
+
+static gint
+compare_sample (gconstpointer a,
+                gconstpointer b)
+{
+    gint64 sample_a = *(const gint64 *) a;
+    gint64 sample_b = *(const gint64 *) b;
+
+    return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+/**
+ * samples_new:
+ *
+ * Creates a new array of gint64 samples
+ *
+ * Returns: (transfer full): a new #GArray
+ *
+ **/
+GArray *
+samples_new (void)
+{
+    return g_array_new (FALSE, FALSE, sizeof (gint64));
+}
+
+/**
+ * samples_add:
+ *
+ * Add a sample
+ *
+ * @samples: a #GArray of samples
+ * @value: sample value
+ *
+ **/
+void
+samples_add (GArray *samples,
+             gint64  value)
+{
+    g_array_append_val (samples, value);
+}
+
+/**
+ * samples_sort:
+ *
+ * Sort samples, needed before samples_percentile()
+ *
+ * @samples: a #GArray of samples
+ *
+ **/
+void
+samples_sort (GArray *samples)
+{
+    g_array_sort (samples, compare_sample);
+}
+
+/**
+ * samples_percentile:
+ *
+ * Get a percentile of sorted samples
+ *
+ * @samples: a sorted #GArray of samples
+ * @percent: percentile, 100 is the maximum
+ *
+ * Returns: sample value or 0 if empty
+ *
+ **/
+gint64
+samples_percentile (GArray *samples,
+                    guint   percent)
+{
+    if (samples->len == 0)
+        return 0;
+
+    return g_array_index (
+        samples, gint64, (samples->len - 1) * percent / 100
+    );
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef SAMPLES_H
+#define SAMPLES_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+GArray*         samples_new        (void);
+void            samples_add        (GArray *samples,
+                                    gint64  value);
+void            samples_sort       (GArray *samples);
+gint64          samples_percentile (GArray *samples,
+                                    guint   percent);
+
+G_END_DECLS
+
+#endif
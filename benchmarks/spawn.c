@@ -0,0 +1,217 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "spawn.h"
+
+#define READY_STATE "READY=1"
+#define SETTINGS_GROUP "[org/adishatz/HeadphoneManager]\n"
+#define NOTIFY_BUFFER_SIZE 4096
+
+/**
+ * spawn_listen:
+ *
+ * Bind a local notify socket, as systemd does for Type=notify services
+ *
+ * @path: socket path
+ *
+ * Returns: a datagram socket or -1
+ *
+ **/
+int
+spawn_listen (const char *path)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen (path) >= sizeof (address.sun_path))
+        return -1;
+
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, path);
+
+    fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (bind (fd, (struct sockaddr *) &address, sizeof (address)) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * spawn_wait_ready:
+ *
+ * Wait for READY=1 on a notify socket
+ *
+ * @fd: a socket from spawn_listen()
+ * @deadline: monotonic time in µs to give up at
+ *
+ * Returns: TRUE if READY=1 was received before @deadline
+ *
+ **/
+gboolean
+spawn_wait_ready (int    fd,
+                  gint64 deadline)
+{
+    struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+    char buffer[NOTIFY_BUFFER_SIZE];
+
+    for (;;) {
+        g_auto (GStrv) states = NULL;
+        gint64 remaining = deadline - g_get_monotonic_time ();
+        ssize_t len;
+
+        if (remaining <= 0 ||
+                poll (&pollfd, 1, remaining / G_TIME_SPAN_MILLISECOND) <= 0)
+            return FALSE;
+
+        len = recv (fd, buffer, sizeof (buffer) - 1, 0);
+        if (len < 0)
+            return FALSE;
+        buffer[len] = '\0';
+
+        /* Datagram is a newline separated list of assignments */
+        states = g_strsplit (buffer, "\n", -1);
+        if (g_strv_contains ((const char * const *) states, READY_STATE))
+            return TRUE;
+    }
+}
+
+/**
+ * spawn_get_environ:
+ *
+ * Get an environment isolating the daemon: runtime directory, notify
+ * socket and schemas from the build directory. Settings are defaults
+ * held in memory, or @settings written to a keyfile backend under
+ * @runtime_dir. Session bus is inherited.
+ *
+ * @runtime_dir: XDG_RUNTIME_DIR
+ * @socket_path: NOTIFY_SOCKET
+ * @schema_dir: GSETTINGS_SCHEMA_DIR
+ * @settings: (nullable): keyfile lines, like "card='null'"
+ *
+ * Returns: (transfer full): an environment for spawn_daemon()
+ *
+ **/
+char **
+spawn_get_environ (const char *runtime_dir,
+                   const char *socket_path,
+                   const char *schema_dir,
+                   const char *settings)
+{
+    g_autofree char *config_dir = NULL;
+    g_autofree char *keyfile_dir = NULL;
+    g_autofree char *keyfile = NULL;
+    g_autofree char *contents = NULL;
+    char **envp = g_get_environ ();
+
+    envp = g_environ_setenv (envp, "NOTIFY_SOCKET", socket_path, TRUE);
+    envp = g_environ_setenv (envp, "XDG_RUNTIME_DIR", runtime_dir, TRUE);
+    envp = g_environ_setenv (envp, "GSETTINGS_SCHEMA_DIR", schema_dir, TRUE);
+
+    if (settings == NULL) {
+        envp = g_environ_setenv (envp, "GSETTINGS_BACKEND", "memory", TRUE);
+        return envp;
+    }
+
+    /* Keyfile backend reads $XDG_CONFIG_HOME/glib-2.0/settings/keyfile */
+    config_dir = g_build_filename (runtime_dir, "config", NULL);
+    keyfile_dir = g_build_filename (config_dir, "glib-2.0", "settings", NULL);
+    keyfile = g_build_filename (keyfile_dir, "keyfile", NULL);
+    contents = g_strconcat (SETTINGS_GROUP, settings, NULL);
+
+    if (g_mkdir_with_parents (keyfile_dir, 0700) < 0 ||
+            !g_file_set_contents (keyfile, contents, -1, NULL))
+        g_printerr ("Can't write settings to %s\n", keyfile);
+
+    envp = g_environ_setenv (envp, "XDG_CONFIG_HOME", config_dir, TRUE);
+    envp = g_environ_setenv (envp, "GSETTINGS_BACKEND", "keyfile", TRUE);
+
+    return envp;
+}
+
+/**
+ * spawn_daemon:
+ *
+ * Start daemon, to be stopped with spawn_stop()
+ *
+ * @daemon: daemon path
+ * @envp: environment from spawn_get_environ()
+ * @pid: (out): daemon pid
+ *
+ * Returns: TRUE if daemon was started
+ *
+ **/
+gboolean
+spawn_daemon (const char  *daemon,
+              char       **envp,
+              GPid        *pid)
+{
+    g_autoptr (GError) error = NULL;
+    char *argv[] = { (char *) daemon, NULL };
+
+    if (!g_spawn_async (NULL, argv, envp, G_SPAWN_DO_NOT_REAP_CHILD,
+                        NULL, NULL, pid, &error)) {
+        g_printerr ("Can't spawn %s: %s\n", daemon, error->message);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * spawn_stop:
+ *
+ * Terminate daemon and reap it
+ *
+ * @pid: pid from spawn_daemon()
+ *
+ **/
+void
+spawn_stop (GPid pid)
+{
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+    g_spawn_close_pid (pid);
+}
+
+/**
+ * spawn_remove_dir:
+ *
+ * Remove a runtime directory and what daemon and settings left in it
+ *
+ * @path: directory path
+ *
+ **/
+void
+spawn_remove_dir (const char *path)
+{
+    g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+    const char *name;
+
+    while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+        g_autofree char *file = g_build_filename (path, name, NULL);
+
+        if (g_file_test (file, G_FILE_TEST_IS_DIR))
+            spawn_remove_dir (file);
+        else
+            g_remove (file);
+    }
+
+    g_rmdir (path);
+}
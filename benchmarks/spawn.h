@@ -0,0 +1,27 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+int             spawn_listen            (const char  *path);
+gboolean        spawn_wait_ready        (int          fd,
+                                         gint64       deadline);
+char**          spawn_get_environ       (const char  *runtime_dir,
+                                         const char  *socket_path,
+                                         const char  *schema_dir,
+                                         const char  *settings);
+gboolean        spawn_daemon            (const char  *daemon,
+                                         char       **envp,
+                                         GPid        *pid);
+void            spawn_stop              (GPid         pid);
+void            spawn_remove_dir        (const char  *path);
+
+G_END_DECLS
+
+#endif
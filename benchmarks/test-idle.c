@@ -0,0 +1,337 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "config.h"
+#include "spawn.h"
+
+#define NOTIFY_SOCKET_NAME "notify"
+#define READY_TIMEOUT (10 * G_USEC_PER_SEC)
+#define SETTLE_TIME (1 * G_USEC_PER_SEC)
+#define REPLY_TIME (100 * G_TIME_SPAN_MILLISECOND)
+#define VOLUNTARY_SWITCHES "voluntary_ctxt_switches:"
+#define INPUT_DIR_NAME "input"
+/* Not a device, only wakes the input watch up */
+#define INPUT_PROBE_NAME "event-probe"
+#define EPOLL_FD_LINK "anon_inode:[eventpoll]"
+#define INOTIFY_FD_LINK "anon_inode:inotify"
+
+/*
+ * Production input path, fed by an empty input directory: epoll source,
+ * inotify watch, device cache in the runtime directory, logind
+ * subscription on the private bus and jack controls of sound cards,
+ * which are only read. No mixer is opened.
+ */
+#define INPUT_SETTINGS \
+    "detection-backends=['evdev', 'alsa-jack']\n" \
+    "input-dir='%s'\n" \
+    "card='null'\n" \
+    "plug-elements=@as []\n" \
+    "unplug-elements=@as []\n"
+
+#define DBUS_SERVICE_PATH               "/org/adishatz/HeadphoneManager"
+#define DBUS_SERVICE_INTERFACE          "org.adishatz.HeadphoneManager"
+
+static GVariant *
+get_counters (GDBusConnection *connection,
+              GError         **error)
+{
+    g_autoptr (GVariant) reply = NULL;
+    GVariant *counters;
+
+    reply = g_dbus_connection_call_sync (
+        connection,
+        APP_ID,
+        DBUS_SERVICE_PATH,
+        DBUS_SERVICE_INTERFACE,
+        "GetCounters",
+        NULL,
+        G_VARIANT_TYPE ("(a{st})"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        error
+    );
+
+    if (reply == NULL)
+        return NULL;
+
+    g_variant_get (reply, "(@a{st})", &counters);
+
+    return counters;
+}
+
+static guint64
+lookup (GVariant   *counters,
+        const char *key)
+{
+    GVariantIter iter;
+    const char *name;
+    guint64 value;
+
+    g_variant_iter_init (&iter, counters);
+    while (g_variant_iter_next (&iter, "{&st}", &name, &value)) {
+        if (g_strcmp0 (name, key) == 0)
+            return value;
+    }
+
+    return 0;
+}
+
+/* Service is exported once deferred initialisation ran */
+static GVariant *
+wait_counters (GDBusConnection *connection,
+               gint64           deadline)
+{
+    while (g_get_monotonic_time () < deadline) {
+        g_autoptr (GError) error = NULL;
+        GVariant *counters = get_counters (connection, &error);
+
+        if (counters != NULL)
+            return counters;
+
+        g_usleep (50 * G_TIME_SPAN_MILLISECOND);
+    }
+
+    return NULL;
+}
+
+/* Main thread sleeps in poll() while idle, each wakeup is a switch */
+static gboolean
+get_context_switches (GPid     pid,
+                      guint64 *switches)
+{
+    g_autofree char *path = g_strdup_printf ("/proc/%d/status", pid);
+    g_autofree char *status = NULL;
+    const char *line;
+
+    if (!g_file_get_contents (path, &status, NULL, NULL))
+        return FALSE;
+
+    line = strstr (status, "\n" VOLUNTARY_SWITCHES);
+    if (line == NULL)
+        return FALSE;
+
+    *switches = g_ascii_strtoull (
+        line + strlen ("\n" VOLUNTARY_SWITCHES), NULL, 10
+    );
+
+    return TRUE;
+}
+
+static gboolean
+has_fd_link (GPid        pid,
+             const char *target)
+{
+    g_autofree char *path = g_strdup_printf ("/proc/%d/fd", pid);
+    g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+    const char *name;
+
+    while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+        g_autofree char *fd = g_build_filename (path, name, NULL);
+        g_autofree char *link = g_file_read_link (fd, NULL);
+
+        if (g_strcmp0 (link, target) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Idle must be measured with the input path armed */
+static gboolean
+check_input (GDBusConnection *connection,
+             GPid             pid,
+             const char      *input_dir,
+             gint64           deadline)
+{
+    g_autofree char *probe = NULL;
+    g_autoptr (GVariant) before = NULL;
+    guint64 wakeups;
+
+    if (!has_fd_link (pid, EPOLL_FD_LINK) ||
+            !has_fd_link (pid, INOTIFY_FD_LINK)) {
+        g_printerr ("Input devices aren't watched\n");
+        return FALSE;
+    }
+
+    before = get_counters (connection, NULL);
+    if (before == NULL)
+        return FALSE;
+    wakeups = lookup (before, "input-wakeups");
+
+    probe = g_build_filename (input_dir, INPUT_PROBE_NAME, NULL);
+    if (!g_file_set_contents (probe, "", 0, NULL)) {
+        g_printerr ("Can't create %s\n", probe);
+        return FALSE;
+    }
+
+    while (g_get_monotonic_time () < deadline) {
+        g_autoptr (GVariant) counters = get_counters (connection, NULL);
+
+        if (counters != NULL && lookup (counters, "input-wakeups") > wakeups)
+            return TRUE;
+
+        g_usleep (50 * G_TIME_SPAN_MILLISECOND);
+    }
+
+    g_printerr ("No input wakeup for %s\n", probe);
+
+    return FALSE;
+}
+
+static gboolean
+check_idle (GDBusConnection *connection,
+            GPid             pid,
+            guint            idle)
+{
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GVariant) before = NULL;
+    g_autoptr (GVariant) after = NULL;
+    guint64 start, end;
+
+    g_usleep (SETTLE_TIME);
+
+    before = get_counters (connection, &error);
+    if (before == NULL) {
+        g_printerr ("Can't get counters: %s\n", error->message);
+        return FALSE;
+    }
+
+    /* Reply may be read before the daemon went back to sleep */
+    g_usleep (REPLY_TIME);
+
+    /* No call during the window, measured from outside */
+    if (!get_context_switches (pid, &start)) {
+        g_printerr ("Can't read context switches of %d\n", pid);
+        return FALSE;
+    }
+
+    g_usleep (idle * G_USEC_PER_SEC);
+
+    if (!get_context_switches (pid, &end)) {
+        g_printerr ("Can't read context switches of %d\n", pid);
+        return FALSE;
+    }
+
+    after = get_counters (connection, &error);
+    if (after == NULL) {
+        g_printerr ("Can't get counters: %s\n", error->message);
+        return FALSE;
+    }
+
+    g_print (
+        "%us idle: %" G_GUINT64_FORMAT " wakeups, %" G_GUINT64_FORMAT
+        " input wakeups, %" G_GUINT64_FORMAT " loop iterations between"
+        " calls  (%" G_GUINT64_FORMAT " threads, %" G_GUINT64_FORMAT
+        " kB RSS, %" G_GUINT64_FORMAT " fds)\n",
+        idle,
+        end - start,
+        lookup (after, "input-wakeups") - lookup (before, "input-wakeups"),
+        lookup (after, "loop-iterations") - lookup (before, "loop-iterations"),
+        lookup (after, "threads"),
+        lookup (after, "rss-kb"),
+        lookup (after, "fds")
+    );
+
+    return end == start &&
+        lookup (after, "input-wakeups") == lookup (before, "input-wakeups");
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GTestDBus) test_bus = NULL;
+    g_autoptr (GDBusConnection) connection = NULL;
+    g_autoptr (GVariant) counters = NULL;
+    g_autofree char *runtime_dir = NULL;
+    g_autofree char *socket_path = NULL;
+    g_autofree char *input_dir = NULL;
+    g_autofree char *settings = NULL;
+    g_auto (GStrv) envp = NULL;
+    gboolean idle_ok = FALSE;
+    gint idle = 5;
+    GPid pid;
+    int fd;
+    GOptionEntry main_entries[] = {
+        {"idle", 0, 0, G_OPTION_ARG_INT, &idle, "Idle period in seconds", "SECONDS"},
+        {NULL}
+    };
+
+    context = g_option_context_new ("DAEMON SCHEMA_DIR - check idle wakeups");
+    g_option_context_add_main_entries (context, main_entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (argc != 3) {
+        g_printerr ("Usage: %s DAEMON SCHEMA_DIR\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    runtime_dir = g_dir_make_tmp ("hm-idle-XXXXXX", &error);
+    if (runtime_dir == NULL) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    socket_path = g_build_filename (runtime_dir, NOTIFY_SOCKET_NAME, NULL);
+    fd = spawn_listen (socket_path);
+    if (fd < 0) {
+        g_printerr ("Can't bind %s: %s\n", socket_path, g_strerror (errno));
+        spawn_remove_dir (runtime_dir);
+        return EXIT_FAILURE;
+    }
+
+    input_dir = g_build_filename (runtime_dir, INPUT_DIR_NAME, NULL);
+    g_mkdir_with_parents (input_dir, 0700);
+    settings = g_strdup_printf (INPUT_SETTINGS, input_dir);
+
+    /* Private bus without players: no jack nor MPRIS activity */
+    test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (test_bus);
+
+    envp = spawn_get_environ (runtime_dir, socket_path, argv[2], settings);
+    /* logind is subscribed to on the private bus, it never sends */
+    envp = g_environ_setenv (
+        envp,
+        "DBUS_SYSTEM_BUS_ADDRESS",
+        g_test_dbus_get_bus_address (test_bus),
+        TRUE
+    );
+
+    if (spawn_daemon (argv[1], envp, &pid)) {
+        gint64 deadline = g_get_monotonic_time () + READY_TIMEOUT;
+
+        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+
+        if (!spawn_wait_ready (fd, deadline))
+            g_printerr ("No READY=1 from %s\n", argv[1]);
+        else if (connection == NULL)
+            g_printerr ("%s\n", error->message);
+        else if ((counters = wait_counters (connection, deadline)) == NULL)
+            g_printerr ("%s not exported\n", DBUS_SERVICE_PATH);
+        else if (check_input (connection, pid, input_dir, deadline))
+            idle_ok = check_idle (connection, pid, MAX (idle, 1));
+
+        spawn_stop (pid);
+    }
+
+    g_clear_object (&connection);
+    g_test_dbus_down (test_bus);
+    close (fd);
+    spawn_remove_dir (runtime_dir);
+
+    return idle_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -10,9 +10,64 @@
 #include "config.h"
 #include "events.h"
 #include "alsa.h"
+#include "recorder.h"
+#include "stats.h"
+
+#define DEFAULT_CARD "default"
+#define DEFAULT_ELEMENT "Master"
+#define CARD_SEPARATOR '@'
+
+/* properties */
+enum
+{
+    PROP_0,
+    PROP_CARD,
+    PROP_PLUG_ELEMENTS,
+    PROP_UNPLUG_ELEMENTS,
+    LAST_PROP
+};
+
+static GParamSpec *properties[LAST_PROP];
+
+struct Mixer {
+    Alsa        *self;
+    char        *card;
+    snd_mixer_t *handle;
+    GSource     *source;
+};
+
+struct Element {
+    char             *name;
+    /* Recorded id, stable across settings changes */
+    guint32           id;
+    struct Mixer     *mixer;
+    /* NULL while removed from mixer */
+    snd_mixer_elem_t *elem;
+
+    /* Current volume, kept up to date by mixer events */
+    long current;
+    /* Preset volume for speaker (0) and headphone (1) */
+    long volume[2];
+};
+
+typedef struct {
+    GSource       source;
+    struct Mixer *mixer;
+} AlsaSource;
 
 struct _AlsaPrivate {
-    long volume;
+    /* card -> struct Mixer */
+    GHashTable *mixers;
+    /* "element@card" -> struct Element, built once per card */
+    GHashTable *elements;
+
+    /* Card of element specs without one */
+    char       *card;
+    /* Configured element specs and resolved elements, per headphone state */
+    char      **specs[2];
+    GPtrArray  *transitions[2];
+
+    gint headphone_state;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -23,45 +78,525 @@ G_DEFINE_TYPE_WITH_CODE (
 )
 
 static void
-volume_switch (Alsa *self)
+update_volume (struct Element *element)
 {
-    snd_mixer_t *handle;
-    snd_mixer_selem_id_t *sid;
-    const char *card = "default";
-    const char *selem_name = "Master";
-    snd_mixer_elem_t* elem;
-    long volume = self->priv->volume;
-
-    snd_mixer_open (&handle, 0);
-    snd_mixer_attach (handle, card);
-    snd_mixer_selem_register (handle, NULL, NULL);
-    snd_mixer_load (handle);
-
-    snd_mixer_selem_id_alloca (&sid);
-    snd_mixer_selem_id_set_index (sid, 0);
-    snd_mixer_selem_id_set_name (sid, selem_name);
-    elem = snd_mixer_find_selem (handle, sid);
-
-    snd_mixer_selem_get_playback_volume(elem, 0, &self->priv->volume);
-
-    if (volume != -1) {
-        snd_mixer_selem_set_playback_volume_all (
-            elem, volume
+    if (element->elem == NULL)
+        return;
+
+    snd_mixer_selem_get_playback_volume (element->elem, 0, &element->current);
+}
+
+static int
+on_elem_event (snd_mixer_elem_t *elem,
+               unsigned int      mask)
+{
+    struct Element *element = snd_mixer_elem_get_callback_private (elem);
+
+    if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+        g_warning ("Mixer element removed: %s", element->name);
+        element->elem = NULL;
+    } else if (mask & SND_CTL_EVENT_MASK_VALUE) {
+        update_volume (element);
+    }
+
+    return 0;
+}
+
+static void attach_elem (Alsa             *self,
+                         struct Mixer     *mixer,
+                         snd_mixer_elem_t *elem);
+static void lose_mixer (Alsa         *self,
+                        struct Mixer *mixer);
+
+static int
+on_mixer_event (snd_mixer_t      *handle,
+                unsigned int      mask,
+                snd_mixer_elem_t *elem)
+{
+    struct Mixer *mixer = snd_mixer_get_callback_private (handle);
+
+    /* Element back after a codec reprobe */
+    if ((mask & SND_CTL_EVENT_MASK_ADD) &&
+            snd_mixer_selem_has_playback_volume (elem))
+        attach_elem (mixer->self, mixer, elem);
+
+    return 0;
+}
+
+static gboolean
+alsa_source_dispatch (GSource     *source,
+                      GSourceFunc  callback,
+                      gpointer     user_data)
+{
+    struct Mixer *mixer = ((AlsaSource *) source)->mixer;
+
+    if (snd_mixer_handle_events (mixer->handle) >= 0)
+        return G_SOURCE_CONTINUE;
+
+    /* Card is gone, reopened on next transition */
+    g_warning ("Mixer lost: %s", mixer->card);
+    lose_mixer (mixer->self, mixer);
+
+    return G_SOURCE_REMOVE;
+}
+
+static GSourceFuncs alsa_source_funcs = {
+    NULL,
+    NULL,
+    alsa_source_dispatch,
+    NULL,
+    NULL,
+    NULL
+};
+
+static char *
+get_element_key (const char   *name,
+                 unsigned int  index,
+                 const char   *card)
+{
+    if (index == 0)
+        return g_strdup_printf ("%s%c%s", name, CARD_SEPARATOR, card);
+
+    return g_strdup_printf ("%s,%u%c%s", name, index, CARD_SEPARATOR, card);
+}
+
+static void
+clear_element (struct Element *element)
+{
+    g_free (element->name);
+    g_free (element);
+}
+
+static void
+close_mixer (struct Mixer *mixer)
+{
+    snd_mixer_elem_t *elem;
+
+    if (mixer->source != NULL) {
+        g_source_destroy (mixer->source);
+        g_clear_pointer (&mixer->source, g_source_unref);
+    }
+
+    /* Closing removes elements, they must not call back into us */
+    if (mixer->handle != NULL) {
+        snd_mixer_set_callback (mixer->handle, NULL);
+        for (elem = snd_mixer_first_elem (mixer->handle);
+                elem != NULL;
+                elem = snd_mixer_elem_next (elem))
+            snd_mixer_elem_set_callback (elem, NULL);
+    }
+
+    g_clear_pointer (&mixer->handle, snd_mixer_close);
+}
+
+static void
+clear_mixer (struct Mixer *mixer)
+{
+    close_mixer (mixer);
+    g_free (mixer->card);
+    g_free (mixer);
+}
+
+static void
+watch_mixer (struct Mixer *mixer)
+{
+    struct pollfd *fds;
+    int i, count;
+
+    count = snd_mixer_poll_descriptors_count (mixer->handle);
+    if (count <= 0)
+        return;
+
+    fds = g_new0 (struct pollfd, count);
+    count = snd_mixer_poll_descriptors (mixer->handle, fds, count);
+
+    mixer->source = g_source_new (&alsa_source_funcs, sizeof (AlsaSource));
+    ((AlsaSource *) mixer->source)->mixer = mixer;
+    g_source_set_name (mixer->source, "headphone-manager alsa");
+
+    for (i = 0; i < count; i++)
+        g_source_add_unix_fd (
+            mixer->source, fds[i].fd, (GIOCondition) fds[i].events
         );
+
+    g_source_attach (mixer->source, NULL);
+
+    g_free (fds);
+}
+
+/* Elements are kept across removals, presets survive a reprobe */
+static void
+attach_elem (Alsa             *self,
+             struct Mixer     *mixer,
+             snd_mixer_elem_t *elem)
+{
+    g_autofree char *key = get_element_key (
+        snd_mixer_selem_get_name (elem),
+        snd_mixer_selem_get_index (elem),
+        mixer->card
+    );
+    struct Element *element;
+
+    element = g_hash_table_lookup (self->priv->elements, key);
+    if (element == NULL) {
+        element = g_new0 (struct Element, 1);
+        element->name = g_steal_pointer (&key);
+        element->id = g_str_hash (element->name);
+        element->mixer = mixer;
+        element->volume[0] = -1;
+        element->volume[1] = -1;
+        g_hash_table_insert (self->priv->elements, element->name, element);
     }
 
-    snd_mixer_close (handle);
+    element->elem = elem;
+    snd_mixer_elem_set_callback_private (elem, element);
+    snd_mixer_elem_set_callback (elem, on_elem_event);
+    update_volume (element);
+}
+
+static void
+index_elements (Alsa         *self,
+                struct Mixer *mixer)
+{
+    snd_mixer_elem_t *elem;
+
+    for (elem = snd_mixer_first_elem (mixer->handle);
+            elem != NULL;
+            elem = snd_mixer_elem_next (elem)) {
+        if (snd_mixer_selem_has_playback_volume (elem))
+            attach_elem (self, mixer, elem);
+    }
+}
+
+static gboolean
+load_mixer (Alsa         *self,
+            struct Mixer *mixer)
+{
+    int err;
+
+    if ((err = snd_mixer_open (&mixer->handle, 0)) < 0 ||
+            (err = snd_mixer_attach (mixer->handle, mixer->card)) < 0 ||
+            (err = snd_mixer_selem_register (mixer->handle, NULL, NULL)) < 0 ||
+            (err = snd_mixer_load (mixer->handle)) < 0) {
+        g_warning ("Can't open mixer %s: %s", mixer->card, snd_strerror (err));
+        g_clear_pointer (&mixer->handle, snd_mixer_close);
+        return FALSE;
+    }
+
+    index_elements (self, mixer);
+    snd_mixer_set_callback_private (mixer->handle, mixer);
+    snd_mixer_set_callback (mixer->handle, on_mixer_event);
+    watch_mixer (mixer);
+
+    return TRUE;
+}
+
+static void
+lose_mixer (Alsa         *self,
+            struct Mixer *mixer)
+{
+    GHashTableIter iter;
+    struct Element *element;
+
+    close_mixer (mixer);
+
+    g_hash_table_iter_init (&iter, self->priv->elements);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &element)) {
+        if (element->mixer == mixer)
+            element->elem = NULL;
+    }
+}
+
+static struct Mixer *
+open_mixer (Alsa       *self,
+            const char *card)
+{
+    struct Mixer *mixer;
+
+    mixer = g_hash_table_lookup (self->priv->mixers, card);
+    if (mixer != NULL)
+        return mixer;
+
+    mixer = g_new0 (struct Mixer, 1);
+    mixer->self = self;
+    mixer->card = g_strdup (card);
+
+    /* Failed cards are kept without handle until pruned */
+    g_hash_table_insert (self->priv->mixers, mixer->card, mixer);
+    load_mixer (self, mixer);
+
+    return mixer;
+}
+
+/* Reopen lost mixers of configured elements, like a replugged card */
+static void
+reload_mixers (Alsa      *self,
+               GPtrArray *elements)
+{
+    guint i;
+
+    for (i = 0; i < elements->len; i++) {
+        struct Element *element = g_ptr_array_index (elements, i);
+
+        if (element->elem == NULL && element->mixer->handle == NULL)
+            load_mixer (self, element->mixer);
+    }
+}
+
+static gboolean
+is_mixer_element (gpointer key,
+                  gpointer value,
+                  gpointer user_data)
+{
+    return ((struct Element *) value)->mixer == user_data;
+}
+
+/* Close mixers no configured element uses anymore */
+static void
+prune_mixers (Alsa *self)
+{
+    g_autoptr (GHashTable) used = NULL;
+    GHashTableIter iter;
+    struct Mixer *mixer;
+    guint state, i;
+
+    if (self->priv->transitions[FALSE] == NULL ||
+            self->priv->transitions[TRUE] == NULL)
+        return;
+
+    used = g_hash_table_new (NULL, NULL);
+    for (state = FALSE; state <= TRUE; state++) {
+        GPtrArray *elements = self->priv->transitions[state];
+
+        for (i = 0; i < elements->len; i++) {
+            struct Element *element = g_ptr_array_index (elements, i);
+
+            g_hash_table_add (used, element->mixer);
+        }
+    }
+
+    g_hash_table_iter_init (&iter, self->priv->mixers);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mixer)) {
+        if (g_hash_table_contains (used, mixer))
+            continue;
+
+        g_hash_table_foreach_remove (
+            self->priv->elements, is_mixer_element, mixer
+        );
+        g_hash_table_iter_remove (&iter);
+    }
+}
+
+static GPtrArray *
+resolve_elements (Alsa        *self,
+                  char *const *specs)
+{
+    GPtrArray *elements = g_ptr_array_new ();
+    const char *default_card = self->priv->card;
+    guint i;
+
+    for (i = 0; specs != NULL && specs[i] != NULL; i++) {
+        g_autofree char *key = NULL;
+        const char *card = strrchr (specs[i], CARD_SEPARATOR);
+        struct Element *element;
+
+        if (card == NULL) {
+            key = g_strdup_printf (
+                "%s%c%s", specs[i], CARD_SEPARATOR, default_card
+            );
+            card = default_card;
+        } else {
+            key = g_strdup (specs[i]);
+            card++;
+        }
+
+        open_mixer (self, card);
+
+        element = g_hash_table_lookup (self->priv->elements, key);
+        if (element == NULL) {
+            g_warning ("Can't find mixer element %s", key);
+            continue;
+        }
+
+        g_ptr_array_add (elements, element);
+    }
+
+    return elements;
+}
+
+static void
+resolve_transition (Alsa     *self,
+                    gboolean  headphone_state)
+{
+    /* Nothing resolved yet, constructed() will */
+    if (self->priv->transitions[headphone_state] == NULL)
+        return;
+
+    g_ptr_array_unref (self->priv->transitions[headphone_state]);
+    self->priv->transitions[headphone_state] = resolve_elements (
+        self, self->priv->specs[headphone_state]
+    );
+}
+
+static void
+set_elements (Alsa        *self,
+              gboolean     headphone_state,
+              char *const *specs)
+{
+    const char *default_elements[] = { DEFAULT_ELEMENT, NULL };
+
+    g_strfreev (self->priv->specs[headphone_state]);
+    self->priv->specs[headphone_state] = g_strdupv (
+        specs != NULL ? (char **) specs : (char **) default_elements
+    );
+
+    resolve_transition (self, headphone_state);
+    prune_mixers (self);
+}
+
+static void
+set_card (Alsa       *self,
+          const char *card)
+{
+    g_free (self->priv->card);
+    self->priv->card = g_strdup (card != NULL ? card : DEFAULT_CARD);
+
+    resolve_transition (self, FALSE);
+    resolve_transition (self, TRUE);
+    prune_mixers (self);
+}
+
+static void
+volume_switch (Alsa     *self,
+               gboolean  headphone_state)
+{
+    GPtrArray *previous = self->priv->transitions[!headphone_state];
+    GPtrArray *next = self->priv->transitions[headphone_state];
+    guint i;
+
+    /* Already switched, from a fast path or a bouncing jack */
+    if (self->priv->headphone_state == headphone_state)
+        return;
+
+    self->priv->headphone_state = headphone_state;
+
+    reload_mixers (self, previous);
+    reload_mixers (self, next);
+
+    /* Remember levels of elements set for the previous state */
+    for (i = 0; i < previous->len; i++) {
+        struct Element *element = g_ptr_array_index (previous, i);
+
+        element->volume[!headphone_state] = element->current;
+    }
+
+    for (i = 0; i < next->len; i++) {
+        struct Element *element = g_ptr_array_index (next, i);
+        long volume = element->volume[headphone_state];
+
+        if (element->elem == NULL || volume == -1)
+            continue;
+
+        snd_mixer_selem_set_playback_volume_all (element->elem, volume);
+        element->current = volume;
+
+        recorder_record (
+            RECORDER_MIXER_WRITE,
+            g_get_monotonic_time (),
+            headphone_state,
+            volume,
+            element->id
+        );
+    }
+}
+
+static void
+alsa_set_property (GObject      *object,
+                   guint         property_id,
+                   const GValue *value,
+                   GParamSpec   *pspec)
+{
+    Alsa *self = ALSA (object);
+
+    switch (property_id) {
+    case PROP_CARD:
+        set_card (self, g_value_get_string (value));
+        break;
+    case PROP_PLUG_ELEMENTS:
+        set_elements (self, TRUE, g_value_get_boxed (value));
+        break;
+    case PROP_UNPLUG_ELEMENTS:
+        set_elements (self, FALSE, g_value_get_boxed (value));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+alsa_get_property (GObject    *object,
+                   guint       property_id,
+                   GValue     *value,
+                   GParamSpec *pspec)
+{
+    Alsa *self = ALSA (object);
+
+    switch (property_id) {
+    case PROP_CARD:
+        g_value_set_string (value, self->priv->card);
+        break;
+    case PROP_PLUG_ELEMENTS:
+        g_value_set_boxed (value, self->priv->specs[TRUE]);
+        break;
+    case PROP_UNPLUG_ELEMENTS:
+        g_value_set_boxed (value, self->priv->specs[FALSE]);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+alsa_constructed (GObject *alsa)
+{
+    Alsa *self = ALSA (alsa);
+
+    G_OBJECT_CLASS (alsa_parent_class)->constructed (alsa);
+
+    /* Resolved once all construct properties are known */
+    self->priv->transitions[FALSE] = resolve_elements (
+        self, self->priv->specs[FALSE]
+    );
+    self->priv->transitions[TRUE] = resolve_elements (
+        self, self->priv->specs[TRUE]
+    );
+    prune_mixers (self);
 }
 
 static void
 alsa_dispose (GObject *alsa)
 {
+    Alsa *self = ALSA (alsa);
+
+    g_clear_pointer (&self->priv->transitions[FALSE], g_ptr_array_unref);
+    g_clear_pointer (&self->priv->transitions[TRUE], g_ptr_array_unref);
+    g_clear_pointer (&self->priv->mixers, g_hash_table_destroy);
+    g_clear_pointer (&self->priv->elements, g_hash_table_destroy);
+
     G_OBJECT_CLASS (alsa_parent_class)->dispose (alsa);
 }
 
 static void
 alsa_finalize (GObject *alsa)
 {
+    Alsa *self = ALSA (alsa);
+
+    g_strfreev (self->priv->specs[FALSE]);
+    g_strfreev (self->priv->specs[TRUE]);
+    g_free (self->priv->card);
+
     G_OBJECT_CLASS (alsa_parent_class)->finalize (alsa);
 }
 
@@ -71,15 +606,57 @@ alsa_class_init (AlsaClass *klass)
     GObjectClass *object_class;
 
     object_class = G_OBJECT_CLASS (klass);
+    object_class->set_property = alsa_set_property;
+    object_class->get_property = alsa_get_property;
+    object_class->constructed = alsa_constructed;
     object_class->dispose = alsa_dispose;
     object_class->finalize = alsa_finalize;
+
+    properties[PROP_CARD] = g_param_spec_string (
+        "card",
+        "Card",
+        "Card of mixer elements given without one",
+        DEFAULT_CARD,
+        G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS
+    );
+
+    properties[PROP_PLUG_ELEMENTS] = g_param_spec_boxed (
+        "plug-elements",
+        "Plug elements",
+        "Mixer elements, as element[@card], set when headphone is plugged",
+        G_TYPE_STRV,
+        G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS
+    );
+
+    properties[PROP_UNPLUG_ELEMENTS] = g_param_spec_boxed (
+        "unplug-elements",
+        "Unplug elements",
+        "Mixer elements, as element[@card], set when headphone is unplugged",
+        G_TYPE_STRV,
+        G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS
+    );
+
+    g_object_class_install_properties (object_class, LAST_PROP, properties);
 }
 
 static void
 alsa_init (Alsa *self)
 {
+    const char *default_elements[] = { DEFAULT_ELEMENT, NULL };
+
     self->priv = alsa_get_instance_private (self);
-    self->priv->volume = -1;
+    self->priv->mixers = g_hash_table_new_full (
+        g_str_hash, g_str_equal, NULL, (GDestroyNotify) clear_mixer
+    );
+    self->priv->elements = g_hash_table_new_full (
+        g_str_hash, g_str_equal, NULL, (GDestroyNotify) clear_element
+    );
+    self->priv->card = g_strdup (DEFAULT_CARD);
+    self->priv->specs[FALSE] = g_strdupv ((char **) default_elements);
+    self->priv->specs[TRUE] = g_strdupv ((char **) default_elements);
+    self->priv->transitions[FALSE] = NULL;
+    self->priv->transitions[TRUE] = NULL;
+    self->priv->headphone_state = -1;
 }
 
 /**
@@ -103,11 +680,21 @@ alsa_new (void)
 /**
  * alsa_volume_switch:
  *
- * Switch volume to previous value if any
+ * Switch volume of elements configured for the new headphone state to
+ * their preset if any, saving current volume of elements configured for
+ * the previous state. Does nothing if already switched to this state.
+ *
+ * @self: a #Alsa
+ * @headphone_state: TRUE if headphone is plugged
  *
  **/
 void
-alsa_volume_switch (Alsa *self)
+alsa_volume_switch (Alsa     *self,
+                    gboolean  headphone_state)
 {
-    volume_switch (self);
-}
\ No newline at end of file
+    gint64 start = g_get_monotonic_time ();
+
+    volume_switch (self, headphone_state != FALSE);
+
+    stats_record (STATS_STAGE_VOLUME_SWITCH, g_get_monotonic_time () - start);
+}
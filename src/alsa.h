@@ -44,7 +44,8 @@ struct _AlsaClass {
 GType           alsa_get_type            (void) G_GNUC_CONST;
 
 GObject*        alsa_new                 (void);
-void            alsa_volume_switch       (Alsa *self);
+void            alsa_volume_switch       (Alsa     *self,
+                                          gboolean  headphone_state);
 
 G_END_DECLS
 
@@ -7,18 +7,29 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
 #include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
-#include <poll.h>
+
+#include <gio/gio.h>
 
 #include "config.h"
 #include "events.h"
+#include "recorder.h"
+#include "stats.h"
 #include "utils.h"
 
 #define DEV_INPUT_EVENT "/dev/input"
 #define EVENT_DEV_NAME "event"
+#define SYS_CLASS_INPUT "/sys/class/input"
+#define DEVICES_CACHE_FILE "headphone-manager.devices"
 
 #define BITS_PER_LONG (sizeof(long) * 8)
 #define NBITS(x) ((((x) - 1) / BITS_PER_LONG) + 1)
@@ -26,23 +37,88 @@
 #define LONG(x) ((x) / BITS_PER_LONG)
 #define test_bit(bit, array)	((array[LONG(bit)] >> OFF(bit)) & 1)
 
+#define MAX_EPOLL_EVENTS 16
+#define MAX_INPUT_EVENTS 64
+#define INOTIFY_BUFFER_SIZE 4096
+
+/* Switch codes are below 32, a device state fits in a guint */
+#define SWITCH_BIT(code) (1u << (code))
+#define HEADPHONE_SWITCH SWITCH_BIT (SW_HEADPHONE_INSERT)
+#define TRACKED_SWITCHES (HEADPHONE_SWITCH | \
+                          SWITCH_BIT (SW_MICROPHONE_INSERT) | \
+                          SWITCH_BIT (SW_LINEOUT_INSERT) | \
+                          SWITCH_BIT (SW_JACK_PHYSICAL_INSERT) | \
+                          SWITCH_BIT (SW_VIDEOOUT_INSERT))
+
+#define DBUS_LOGIN_NAME                 "org.freedesktop.login1"
+#define DBUS_LOGIN_PATH                 "/org/freedesktop/login1"
+#define DBUS_LOGIN_MANAGER_INTERFACE    "org.freedesktop.login1.Manager"
+
 /* signals */
 enum
 {
     HEADPHONE_STATE_CHANGED,
+    HEADPHONE_EDGE,
+    SWITCHES_CHANGED,
     LAST_SIGNAL
 };
 
 static guint signals[LAST_SIGNAL];
 
-struct thread_data {
-    char *device;
-    Events *self;
+/* properties */
+enum
+{
+    PROP_0,
+    PROP_DEBOUNCE,
+    PROP_SCAN,
+    PROP_INPUT_DIR,
+    LAST_PROP
+};
+
+static GParamSpec *properties[LAST_PROP];
+
+struct Device {
+    char    *path;
+    int      fd;
+
+    /* Bitmap of tracked switches, by switch code */
+    guint    switches;
+    /* Switches carried by the frame being read, applied on SYN_REPORT */
+    guint    frame_switches;
+    gboolean frame_dirty;
+    /* Events are dropped until next SYN_REPORT, then state is resynced */
+    gboolean dropped;
 };
 
+typedef struct {
+    GSource source;
+    Events *self;
+} EventsSource;
+
 struct _EventsPrivate {
-    GList *threads;
-    GList *fds;
+    int      epoll_fd;
+    int      inotify_fd;
+    GSource *source;
+
+    GList   *devices;
+
+    GCancellable    *cancellable;
+    GDBusConnection *system_bus;
+    guint            sleep_id;
+
+    /* Combined switches of all devices, raw and as last emitted */
+    guint    switches;
+    guint    emitted_switches;
+    /* Switches reported by other backends */
+    guint    external_switches;
+    gint64   timestamp;
+    guint    debounce;
+    guint    debounce_id;
+
+    gboolean scan;
+    char    *input_dir;
+    /* Full scan validating cached devices */
+    guint    scan_id;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -52,128 +128,792 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (Events)
 )
 
-static gboolean
-headphone_present (gpointer user_data)
+static void
+clear_device (struct Device *device)
 {
-    Events *self = EVENTS (user_data);
+    close (device->fd);
+    g_free (device->path);
+    g_free (device);
+}
+
+static struct Device *
+find_device (Events     *self,
+             const char *path)
+{
+    struct Device *device;
+
+    GFOREACH (self->priv->devices, device) {
+        if (g_strcmp0 (device->path, path) == 0)
+            return device;
+    }
+
+    return NULL;
+}
+
+static struct Device *
+register_device (Events     *self,
+                 int         fd,
+                 const char *path)
+{
+    struct Device *device;
+    struct epoll_event epoll_event = { 0 };
+
+    device = g_new0 (struct Device, 1);
+    device->path = g_strdup (path);
+    device->fd = fd;
+
+    epoll_event.events = EPOLLIN;
+    epoll_event.data.ptr = device;
+
+    if (epoll_ctl (self->priv->epoll_fd, EPOLL_CTL_ADD, fd, &epoll_event) < 0) {
+        g_warning ("Can't watch %s", path);
+        clear_device (device);
+        return NULL;
+    }
+
+    self->priv->devices = g_list_append (self->priv->devices, device);
+
+    g_message ("Input device added: %s", path);
+
+    return device;
+}
+
+static struct Device *
+add_device (Events     *self,
+            const char *path)
+{
+    int clock_id = CLOCK_MONOTONIC;
+    int fd;
+
+    if (find_device (self, path) != NULL)
+        return NULL;
+
+    fd = open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        /* Node may only be readable once udev fixed its permissions */
+        if (errno == EACCES)
+            g_debug ("Can't open %s", path);
+        else
+            g_warning ("Can't open %s", path);
+        return NULL;
+    }
+
+    /* Event timestamps then match g_get_monotonic_time() */
+    if (ioctl (fd, EVIOCSCLOCKID, &clock_id) < 0)
+        g_debug ("Can't set monotonic clock: %s", path);
 
+    return register_device (self, fd, path);
+}
+
+static void
+del_device (Events        *self,
+            struct Device *device)
+{
+    epoll_ctl (self->priv->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+
+    self->priv->devices = g_list_remove (self->priv->devices, device);
+    clear_device (device);
+}
+
+static void
+on_headphone_switch (Events   *self,
+                     guint     code,
+                     gboolean  state)
+{
     g_signal_emit(
         self,
         signals[HEADPHONE_STATE_CHANGED],
         0,
-        TRUE
+        state
     );
-
-    return FALSE;
 }
 
-static gboolean
-headphone_absent (gpointer user_data)
+typedef void (*SwitchHandler) (Events *self, guint code, gboolean state);
+
+/*
+ * Handlers of settled switch changes, indexed by switch code. Other
+ * tracked switches have no action yet, they are only reported by
+ * switches-changed and the recorder.
+ */
+static const SwitchHandler switch_handlers[SW_CNT] = {
+    [SW_HEADPHONE_INSERT]     = on_headphone_switch,
+};
+
+static void
+emit_switches (Events *self)
 {
-    Events *self = EVENTS (user_data);
+    guint old_switches = self->priv->emitted_switches;
+    guint changed = old_switches ^ self->priv->switches;
+    gint code = -1;
+
+    if (changed == 0)
+        return;
+
+    self->priv->emitted_switches = self->priv->switches;
+
+    recorder_record (
+        RECORDER_TRANSITION,
+        g_get_monotonic_time (),
+        0,
+        (self->priv->switches & HEADPHONE_SWITCH) != 0,
+        self->priv->switches
+    );
 
     g_signal_emit(
         self,
-        signals[HEADPHONE_STATE_CHANGED],
+        signals[SWITCHES_CHANGED],
         0,
-        FALSE
+        old_switches,
+        self->priv->switches
     );
 
-    return FALSE;
+    while ((code = g_bit_nth_lsf (changed, code)) >= 0) {
+        if (switch_handlers[code] != NULL)
+            switch_handlers[code] (
+                self, code, (self->priv->switches & SWITCH_BIT (code)) != 0
+            );
+    }
+}
+
+static gboolean
+on_debounce_timeout (gpointer user_data)
+{
+    Events *self = EVENTS (user_data);
+
+    self->priv->debounce_id = 0;
+    emit_switches (self);
+
+    return G_SOURCE_REMOVE;
 }
 
-static gpointer
-handle_events (gpointer user_data)
+static void
+update_switches (Events *self,
+                 gint64  timestamp)
 {
-    struct thread_data *data = user_data;
-    struct pollfd fds;
-    const int input_size = sizeof(struct input_event);
-    struct input_event input_data;
+    struct Device *device;
+    guint switches = self->priv->external_switches;
+    guint changed;
 
-    fds.fd = open (data->device, O_RDONLY | O_NONBLOCK);
+    /* Devices are combined, a jack may be split over several of them */
+    GFOREACH (self->priv->devices, device)
+        switches |= device->switches;
 
-    if (fds.fd < 0)
-        goto free;
+    changed = self->priv->switches ^ switches;
+    self->priv->switches = switches;
+    self->priv->timestamp = timestamp;
 
-    data->self->priv->fds = g_list_append (data->self->priv->fds, GINT_TO_POINTER (fds.fd));
+    /* Raw transition, before debouncing */
+    if (changed & HEADPHONE_SWITCH)
+        g_signal_emit (
+            self,
+            signals[HEADPHONE_EDGE],
+            0,
+            (switches & HEADPHONE_SWITCH) != 0,
+            timestamp
+        );
 
-    fds.events = POLLIN;
+    if (self->priv->debounce == 0) {
+        emit_switches (self);
+        return;
+    }
 
-    while (TRUE) {
-        poll(&fds, 1, -1);
+    /* Each edge restarts the window, only the settled state is emitted */
+    g_clear_handle_id (&self->priv->debounce_id, g_source_remove);
+    self->priv->debounce_id = g_timeout_add (
+        self->priv->debounce, on_debounce_timeout, self
+    );
+}
 
-        if(fds.revents) {
-            if (read (fds.fd, &input_data, input_size) < 0)
-                goto free;
+static gboolean
+query_switches (struct Device *device)
+{
+    unsigned long sw[NBITS(SW_MAX)];
+    guint code;
+
+    memset (sw, 0, sizeof(sw));
+    stats_count (STATS_COUNTER_INPUT_SYSCALLS, 1);
+    if (ioctl (device->fd, EVIOCGSW(sizeof(sw)), sw) < 0) {
+        g_warning ("Can't get switch state: %s", device->path);
+        return FALSE;
+    }
 
-            if (input_data.code == SW_HEADPHONE_INSERT) {
-                if (input_data.value) {
-                    g_idle_add ((GSourceFunc) headphone_present, data->self);
-                } else {
-                    g_idle_add ((GSourceFunc) headphone_absent, data->self);
-                }
+    device->switches = 0;
+    for (code = 0; code < SW_CNT; code++) {
+        if ((TRACKED_SWITCHES & SWITCH_BIT (code)) && test_bit(code, sw))
+            device->switches |= SWITCH_BIT (code);
+    }
+    device->frame_switches = device->switches;
+
+    return TRUE;
+}
+
+static void
+seed_device (Events        *self,
+             struct Device *device)
+{
+    struct Device *other;
+
+    if (!query_switches (device))
+        return;
+
+    /* Initial state is known, not a transition. Only this device is
+     * marked as reported, pending changes of others are kept */
+    self->priv->switches = self->priv->external_switches;
+    GFOREACH (self->priv->devices, other)
+        self->priv->switches |= other->switches;
+    self->priv->emitted_switches |= device->switches;
+    self->priv->timestamp = g_get_monotonic_time ();
+}
+
+static void
+resync_device (Events        *self,
+               struct Device *device)
+{
+    if (query_switches (device))
+        update_switches (self, g_get_monotonic_time ());
+}
+
+static void
+remove_device (Events        *self,
+               struct Device *device)
+{
+    g_message ("Input device removed: %s", device->path);
+    del_device (self, device);
+
+    /* Its switches no longer count */
+    update_switches (self, g_get_monotonic_time ());
+}
+
+static void
+resync_devices (Events *self)
+{
+    struct Device *device;
+
+    GFOREACH (self->priv->devices, device)
+        resync_device (self, device);
+}
+
+static void
+handle_event (Events                   *self,
+              struct Device            *device,
+              const struct input_event *input_data)
+{
+    switch (input_data->type) {
+    case EV_SW:
+        recorder_record (
+            RECORDER_SWITCH,
+            input_data->input_event_sec * G_USEC_PER_SEC +
+                input_data->input_event_usec,
+            input_data->code,
+            input_data->value,
+            0
+        );
+        if (!device->dropped && input_data->code < SW_CNT &&
+                (TRACKED_SWITCHES & SWITCH_BIT (input_data->code))) {
+            if (input_data->value)
+                device->frame_switches |= SWITCH_BIT (input_data->code);
+            else
+                device->frame_switches &= ~SWITCH_BIT (input_data->code);
+            device->frame_dirty = TRUE;
+        }
+        break;
+    case EV_SYN:
+        if (input_data->code == SYN_DROPPED) {
+            recorder_record (
+                RECORDER_DROPPED, g_get_monotonic_time (), 0, 0, 0
+            );
+            device->dropped = TRUE;
+            device->frame_switches = device->switches;
+            device->frame_dirty = FALSE;
+        } else if (input_data->code == SYN_REPORT) {
+            if (device->dropped) {
+                device->dropped = FALSE;
+                resync_device (self, device);
+            } else if (device->frame_dirty) {
+                gint64 timestamp = input_data->input_event_sec * G_USEC_PER_SEC +
+                    input_data->input_event_usec;
+
+                stats_record (
+                    STATS_STAGE_READ, g_get_monotonic_time () - timestamp
+                );
+
+                device->switches = device->frame_switches;
+                device->frame_dirty = FALSE;
+                update_switches (self, timestamp);
             }
         }
+        break;
+    default:
+        break;
     }
+}
+
+static gboolean
+handle_events (Events        *self,
+               struct Device *device)
+{
+    struct input_event input_data[MAX_INPUT_EVENTS];
+    ssize_t len;
+    size_t i, count;
 
-free:
-    g_free (data->device);
+    do {
+        len = read (device->fd, input_data, sizeof(input_data));
+        stats_count (STATS_COUNTER_INPUT_SYSCALLS, 1);
 
-    return NULL;
+        if (len < 0)
+            return errno == EAGAIN || errno == EINTR;
+
+        count = len / sizeof(struct input_event);
+        stats_count (STATS_COUNTER_INPUT_EVENTS, count);
+        for (i = 0; i < count; i++)
+            handle_event (self, device, &input_data[i]);
+    } while (count == MAX_INPUT_EVENTS);
+
+    return TRUE;
 }
 
+static gboolean
+is_switch_device_ioctl (const char *path)
+{
+    unsigned long bit[EV_MAX][NBITS(KEY_MAX)];
+    gboolean found = FALSE;
+    int fd;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_debug ("Can't open %s", path);
+        return FALSE;
+    }
+
+    memset (bit, 0, sizeof(bit));
+    ioctl (fd, EVIOCGBIT(0, EV_MAX), bit[0]);
+
+    if (test_bit(EV_SW, bit[0])) {
+        guint code;
+
+        ioctl(fd, EVIOCGBIT(EV_SW, KEY_MAX), bit[EV_SW]);
+        for (code = 0; code < SW_CNT && !found; code++) {
+            found = (TRACKED_SWITCHES & SWITCH_BIT (code)) &&
+                test_bit(code, bit[EV_SW]);
+        }
+    }
+
+    close(fd);
+
+    return found;
+}
+
+static gboolean
+is_switch_device (const char *path)
+{
+    g_autofree char *name = g_path_get_basename (path);
+    g_autofree char *caps_path = NULL;
+    g_autofree char *caps = NULL;
+    const char *word;
+    guint64 sw;
+
+    /* Capabilities are exported without opening the node */
+    caps_path = g_build_filename (
+        SYS_CLASS_INPUT, name, "device", "capabilities", "sw", NULL
+    );
+    if (!g_file_get_contents (caps_path, &caps, NULL, NULL))
+        return is_switch_device_ioctl (path);
+
+    /* Longs in hex, most significant first: codes below 32 are last */
+    g_strstrip (caps);
+    word = strrchr (caps, ' ');
+    sw = g_ascii_strtoull (word != NULL ? word + 1 : caps, NULL, 16);
+
+    return (sw & TRACKED_SWITCHES) != 0;
+}
+
+static void
+handle_inotify (Events *self)
+{
+    char buffer[INOTIFY_BUFFER_SIZE]
+        __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t len;
+    char *ptr;
+
+    while ((len = read (self->priv->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (ptr = buffer; ptr < buffer + len;
+                ptr += sizeof(struct inotify_event) + event->len) {
+            g_autofree char *path = NULL;
+            struct Device *device;
+
+            event = (const struct inotify_event *) ptr;
+
+            if (event->len == 0 ||
+                    !g_str_has_prefix (event->name, EVENT_DEV_NAME))
+                continue;
+
+            path = g_build_filename (
+                self->priv->input_dir, event->name, NULL
+            );
+
+            /*
+             * Removed devices are dropped on their own EPOLLHUP/ENODEV:
+             * freeing them here would leave them in the epoll batch being
+             * dispatched. Node may only be readable once udev fixed its
+             * permissions.
+             */
+            if (find_device (self, path) == NULL &&
+                    is_switch_device (path)) {
+                device = add_device (self, path);
+                if (device != NULL)
+                    resync_device (self, device);
+            }
+        }
+    }
+}
+
+static gboolean
+events_source_dispatch (GSource     *source,
+                        GSourceFunc  callback,
+                        gpointer     user_data)
+{
+    Events *self = ((EventsSource *) source)->self;
+    struct epoll_event epoll_events[MAX_EPOLL_EVENTS];
+    int i, count;
+
+    count = epoll_wait (
+        self->priv->epoll_fd, epoll_events, MAX_EPOLL_EVENTS, 0
+    );
+    stats_count (STATS_COUNTER_INPUT_WAKEUPS, 1);
+    stats_count (STATS_COUNTER_INPUT_SYSCALLS, 1);
+
+    for (i = 0; i < count; i++) {
+        struct Device *device = epoll_events[i].data.ptr;
+
+        /* inotify watch is registered without a device */
+        if (device == NULL) {
+            handle_inotify (self);
+            continue;
+        }
+
+        if (!handle_events (self, device) ||
+                epoll_events[i].events & (EPOLLERR | EPOLLHUP))
+            remove_device (self, device);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs events_source_funcs = {
+    NULL,
+    NULL,
+    events_source_dispatch,
+    NULL,
+    NULL,
+    NULL
+};
+
 static int
 is_event_device (const struct dirent *dir) {
     return strncmp(EVENT_DEV_NAME, dir->d_name, 5) == 0;
 }
 
-static GList*
-scan_devices(Events *self)
+static void
+watch_devices (Events *self)
+{
+    struct epoll_event epoll_event = { 0 };
+
+    self->priv->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (self->priv->inotify_fd < 0) {
+        g_warning ("Can't create inotify instance");
+        return;
+    }
+
+    if (inotify_add_watch (self->priv->inotify_fd,
+                           self->priv->input_dir,
+                           IN_CREATE | IN_ATTRIB) < 0) {
+        g_warning ("Can't watch %s", self->priv->input_dir);
+        return;
+    }
+
+    epoll_event.events = EPOLLIN;
+    epoll_event.data.ptr = NULL;
+
+    if (epoll_ctl (self->priv->epoll_fd, EPOLL_CTL_ADD,
+                   self->priv->inotify_fd, &epoll_event) < 0)
+        g_warning ("Can't watch %s", self->priv->input_dir);
+}
+
+static char *
+get_cache_path (void)
+{
+    return g_build_filename (
+        g_get_user_runtime_dir (), DEVICES_CACHE_FILE, NULL
+    );
+}
+
+static GStrv
+load_cached_devices (void)
+{
+    g_autofree char *path = get_cache_path ();
+    g_autofree char *contents = NULL;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return NULL;
+
+    return g_strsplit (contents, "\n", -1);
+}
+
+static void
+save_cached_devices (Events *self)
+{
+    g_autofree char *path = get_cache_path ();
+    g_autoptr (GString) contents = g_string_new (NULL);
+    g_autoptr (GError) error = NULL;
+    struct Device *device;
+
+    GFOREACH (self->priv->devices, device)
+        g_string_append_printf (contents, "%s\n", device->path);
+
+    if (!g_file_set_contents (path, contents->str, contents->len, &error))
+        g_warning ("Can't save devices: %s", error->message);
+}
+
+/* Returns TRUE if a cached device was attached */
+static gboolean
+attach_cached_devices (Events *self)
+{
+    g_auto (GStrv) paths = load_cached_devices ();
+    gboolean attached = FALSE;
+    guint i;
+
+    for (i = 0; paths != NULL && paths[i] != NULL; i++) {
+        g_autofree char *dir = g_path_get_dirname (paths[i]);
+        struct Device *device;
+
+        /* Node may have been renumbered since, check it again */
+        if (g_strcmp0 (dir, self->priv->input_dir) != 0 ||
+                !is_switch_device (paths[i]))
+            continue;
+
+        device = add_device (self, paths[i]);
+        if (device != NULL) {
+            seed_device (self, device);
+            attached = TRUE;
+        }
+    }
+
+    return attached;
+}
+
+static void
+scan_devices(Events  *self,
+             gboolean seed)
 {
     struct dirent **namelist;
     int i, ndev;
-    GList *devices = NULL;
 
-    ndev = scandir (DEV_INPUT_EVENT, &namelist, is_event_device, alphasort);
+    ndev = scandir (
+        self->priv->input_dir, &namelist, is_event_device, alphasort
+    );
     if (ndev <= 0)
-        return NULL;
+        return;
 
     for (i = 0; i < ndev; i++) {
         char fname[4096];
-        int fd = -1;
-        unsigned long bit[EV_MAX][NBITS(KEY_MAX)];
 
         snprintf (fname, sizeof(fname),
-             "%s/%s", DEV_INPUT_EVENT, namelist[i]->d_name);
+             "%s/%s", self->priv->input_dir, namelist[i]->d_name);
+        free(namelist[i]);
 
-        fd = open (fname, O_RDONLY);
-        if (fd < 0) {
-            g_warning ("Can't open %s", fname);
-            continue;
+        if (find_device (self, fname) == NULL && is_switch_device (fname)) {
+            struct Device *device = add_device (self, fname);
+
+            /* Found once state was reported, a change if it differs */
+            if (device != NULL && seed)
+                seed_device (self, device);
+            else if (device != NULL)
+                resync_device (self, device);
         }
+    }
+    free(namelist);
+}
 
-        memset (bit, 0, sizeof(bit));
-        ioctl (fd, EVIOCGBIT(0, EV_MAX), bit[0]);
+static gboolean
+on_scan (gpointer user_data)
+{
+    Events *self = EVENTS (user_data);
+    gint64 start = g_get_monotonic_time ();
 
-        if (test_bit(EV_SW, bit[0])) {
-            ioctl(fd, EVIOCGBIT(EV_SW, KEY_MAX), bit[EV_SW]);
-            if (test_bit(SW_HEADPHONE_INSERT, bit[EV_SW])) {
-                devices = g_list_append (
-                    devices, g_strdup (fname)
-                );
-            }
-        }
+    self->priv->scan_id = 0;
 
-        free(namelist[i]);
-        close(fd);
+    /* Devices missing from cache were there at startup, not plugged:
+     * hotplugged ones are attached by the watch and skipped here */
+    scan_devices (self, TRUE);
+    save_cached_devices (self);
+
+    stats_record (STATS_STAGE_SCAN, g_get_monotonic_time () - start);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_prepare_for_sleep (GDBusConnection *connection,
+                      const char      *sender_name,
+                      const char      *object_path,
+                      const char      *interface_name,
+                      const char      *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+    Events *self = EVENTS (user_data);
+    gboolean sleeping;
+
+    g_variant_get (parameters, "(b)", &sleeping);
+
+    if (sleeping)
+        return;
+
+    /* Monotonic time stopped while suspended */
+    recorder_sync ();
+    /* Edges may have been lost while suspended */
+    resync_devices (self);
+}
+
+static void
+on_system_bus (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    Events *self;
+    g_autoptr (GError) error = NULL;
+    GDBusConnection *connection;
+
+    connection = g_bus_get_finish (res, &error);
+
+    if (connection == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't watch resume: %s", error->message);
+        return;
+    }
+
+    self = EVENTS (user_data);
+    self->priv->system_bus = connection;
+    self->priv->sleep_id = g_dbus_connection_signal_subscribe (
+        connection,
+        DBUS_LOGIN_NAME,
+        DBUS_LOGIN_MANAGER_INTERFACE,
+        "PrepareForSleep",
+        DBUS_LOGIN_PATH,
+        NULL,
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        on_prepare_for_sleep,
+        self,
+        NULL
+    );
+}
+
+static void
+events_set_property (GObject      *object,
+                     guint         property_id,
+                     const GValue *value,
+                     GParamSpec   *pspec)
+{
+    Events *self = EVENTS (object);
+
+    switch (property_id) {
+    case PROP_DEBOUNCE:
+        self->priv->debounce = g_value_get_uint (value);
+        break;
+    case PROP_SCAN:
+        self->priv->scan = g_value_get_boolean (value);
+        break;
+    case PROP_INPUT_DIR:
+        g_free (self->priv->input_dir);
+        self->priv->input_dir = g_value_dup_string (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+events_get_property (GObject    *object,
+                     guint       property_id,
+                     GValue     *value,
+                     GParamSpec *pspec)
+{
+    Events *self = EVENTS (object);
+
+    switch (property_id) {
+    case PROP_DEBOUNCE:
+        g_value_set_uint (value, self->priv->debounce);
+        break;
+    case PROP_SCAN:
+        g_value_set_boolean (value, self->priv->scan);
+        break;
+    case PROP_INPUT_DIR:
+        g_value_set_string (value, self->priv->input_dir);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+events_constructed (GObject *events)
+{
+    Events *self = EVENTS (events);
+    gint64 start = g_get_monotonic_time ();
+
+    G_OBJECT_CLASS (events_parent_class)->constructed (events);
+
+    if (!self->priv->scan || self->priv->epoll_fd < 0)
+        return;
+
+    /* Watch first so a device appearing during the scan isn't missed */
+    watch_devices (self);
+
+    /* Last known devices are read first, the full scan validates them */
+    if (attach_cached_devices (self)) {
+        self->priv->scan_id = g_idle_add (on_scan, self);
+    } else {
+        scan_devices (self, TRUE);
+        save_cached_devices (self);
     }
 
-    return devices;
+    stats_record (STATS_STAGE_ATTACH, g_get_monotonic_time () - start);
+
+    g_bus_get (
+        G_BUS_TYPE_SYSTEM,
+        self->priv->cancellable,
+        on_system_bus,
+        self
+    );
 }
 
 static void
 events_dispose (GObject *events)
 {
+    Events *self = EVENTS (events);
+
+    g_clear_handle_id (&self->priv->debounce_id, g_source_remove);
+    g_clear_handle_id (&self->priv->scan_id, g_source_remove);
+
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+
+    if (self->priv->sleep_id != 0) {
+        g_dbus_connection_signal_unsubscribe (
+            self->priv->system_bus, self->priv->sleep_id
+        );
+        self->priv->sleep_id = 0;
+    }
+    g_clear_object (&self->priv->system_bus);
+
+    if (self->priv->source != NULL) {
+        g_source_destroy (self->priv->source);
+        g_clear_pointer (&self->priv->source, g_source_unref);
+    }
+
     G_OBJECT_CLASS (events_parent_class)->dispose (events);
 }
 
@@ -181,20 +921,15 @@ static void
 events_finalize (GObject *events)
 {
     Events *self = EVENTS (events);
-    GThread *thread;
-    int *fd;
 
-    GFOREACH (self->priv->fds, fd) {
-        close (*fd);
-        g_free (fd);
-    }
-    g_list_free (self->priv->fds);
+    g_list_free_full (self->priv->devices, (GDestroyNotify) clear_device);
+    g_free (self->priv->input_dir);
 
-    GFOREACH (self->priv->threads, thread) {
-        g_thread_join (thread);
-        g_thread_unref (thread);
-    }
-    g_list_free (self->priv->threads);
+    if (self->priv->inotify_fd >= 0)
+        close (self->priv->inotify_fd);
+
+    if (self->priv->epoll_fd >= 0)
+        close (self->priv->epoll_fd);
 
     G_OBJECT_CLASS (events_parent_class)->finalize (events);
 }
@@ -205,9 +940,38 @@ events_class_init (EventsClass *klass)
     GObjectClass *object_class;
 
     object_class = G_OBJECT_CLASS (klass);
+    object_class->set_property = events_set_property;
+    object_class->get_property = events_get_property;
+    object_class->constructed = events_constructed;
     object_class->dispose = events_dispose;
     object_class->finalize = events_finalize;
 
+    properties[PROP_DEBOUNCE] = g_param_spec_uint (
+        "debounce",
+        "Debounce",
+        "Time in milliseconds a switch state must settle before emission",
+        0, G_MAXUINT, 0,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+    );
+
+    properties[PROP_SCAN] = g_param_spec_boolean (
+        "scan",
+        "Scan",
+        "Watch input devices from input-dir",
+        TRUE,
+        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS
+    );
+
+    properties[PROP_INPUT_DIR] = g_param_spec_string (
+        "input-dir",
+        "Input directory",
+        "Directory of evdev device nodes",
+        DEV_INPUT_EVENT,
+        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS
+    );
+
+    g_object_class_install_properties (object_class, LAST_PROP, properties);
+
     signals[HEADPHONE_STATE_CHANGED] = g_signal_new (
         "headphone-state-changed",
         G_OBJECT_CLASS_TYPE (object_class),
@@ -218,32 +982,66 @@ events_class_init (EventsClass *klass)
         1,
         G_TYPE_BOOLEAN
     );
+
+    signals[HEADPHONE_EDGE] = g_signal_new (
+        "headphone-edge",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        2,
+        G_TYPE_BOOLEAN,
+        G_TYPE_INT64
+    );
+
+    signals[SWITCHES_CHANGED] = g_signal_new (
+        "switches-changed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        2,
+        G_TYPE_UINT,
+        G_TYPE_UINT
+    );
 }
 
 static void
 events_init (Events *self)
 {
-    GList *devices = scan_devices (self);
-    const char *device;
-
     self->priv = events_get_instance_private (self);
-    self->priv->fds = NULL;
-    self->priv->threads = NULL;
-
-    GFOREACH (devices, device) {
-        struct thread_data *data = g_new0(struct thread_data, 1);
-        data->self = self;
-        data->device = g_strdup (device);
-
-        self->priv->threads = g_list_append (
-            self->priv->threads,
-            g_thread_new(
-                NULL, (GThreadFunc) handle_events, data
-            )
-        );
+    self->priv->inotify_fd = -1;
+    self->priv->devices = NULL;
+    self->priv->source = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->system_bus = NULL;
+    self->priv->sleep_id = 0;
+    self->priv->switches = 0;
+    self->priv->emitted_switches = 0;
+    self->priv->external_switches = 0;
+    self->priv->timestamp = 0;
+    self->priv->debounce = 0;
+    self->priv->debounce_id = 0;
+    self->priv->scan = TRUE;
+    self->priv->input_dir = NULL;
+    self->priv->scan_id = 0;
+
+    self->priv->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (self->priv->epoll_fd < 0) {
+        g_warning ("Can't create epoll instance");
+        return;
     }
 
-    g_list_free_full (devices, g_free);
+    /* One source on the default context watches every input device */
+    self->priv->source = g_source_new (
+        &events_source_funcs, sizeof (EventsSource)
+    );
+    ((EventsSource *) self->priv->source)->self = self;
+    g_source_set_name (self->priv->source, "headphone-manager events");
+    g_source_add_unix_fd (self->priv->source, self->priv->epoll_fd, G_IO_IN);
+    g_source_attach (self->priv->source, NULL);
 }
 
 
@@ -264,3 +1062,99 @@ events_new (void)
 
     return events;
 }
+
+/**
+ * events_get_headphone_state:
+ *
+ * Get current headphone state, as last read from the kernel, without
+ * blocking
+ *
+ * @self: a #Events
+ * @timestamp: (out) (optional): monotonic time of last state update in µs
+ *
+ * Returns: TRUE if headphone is plugged
+ *
+ **/
+gboolean
+events_get_headphone_state (Events *self,
+                            gint64 *timestamp)
+{
+    if (timestamp != NULL)
+        *timestamp = self->priv->timestamp;
+
+    return (self->priv->switches & HEADPHONE_SWITCH) != 0;
+}
+
+/**
+ * events_get_switches:
+ *
+ * Get current jack switches, as last read from the kernel
+ *
+ * @self: a #Events
+ *
+ * Returns: bitmap of inserted switches, indexed by SW_* code
+ *
+ **/
+guint
+events_get_switches (Events *self)
+{
+    return self->priv->switches;
+}
+
+/**
+ * events_set_external_switches:
+ *
+ * Merge switches reported by another backend, like ALSA jack controls,
+ * with evdev ones. Changes are debounced and emitted as evdev ones.
+ *
+ * @self: a #Events
+ * @switches: bitmap of inserted switches, indexed by SW_* code
+ * @seed: TRUE if @switches is an initial state, not a transition
+ *
+ **/
+void
+events_set_external_switches (Events  *self,
+                              guint    switches,
+                              gboolean seed)
+{
+    struct Device *device;
+
+    self->priv->external_switches = switches;
+
+    if (!seed) {
+        update_switches (self, g_get_monotonic_time ());
+        return;
+    }
+
+    self->priv->switches = switches;
+    GFOREACH (self->priv->devices, device)
+        self->priv->switches |= device->switches;
+    self->priv->emitted_switches = self->priv->switches;
+    self->priv->timestamp = g_get_monotonic_time ();
+}
+
+/**
+ * events_add_fd:
+ *
+ * Watch an already opened evdev stream, like a pipe fed with recorded
+ * events. Switch state isn't queried from @fd.
+ *
+ * @self: a #Events
+ * @fd: (transfer full): a non blocking file descriptor
+ * @name: name used in logs
+ *
+ * Returns: TRUE if @fd is watched
+ *
+ **/
+gboolean
+events_add_fd (Events     *self,
+               int         fd,
+               const char *name)
+{
+    if (self->priv->epoll_fd < 0) {
+        close (fd);
+        return FALSE;
+    }
+
+    return register_device (self, fd, name) != NULL;
+}
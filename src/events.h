@@ -44,6 +44,16 @@ struct _EventsClass {
 GType           events_get_type            (void) G_GNUC_CONST;
 
 GObject*        events_new                 (void);
+gboolean        events_get_headphone_state (Events *self,
+                                            gint64 *timestamp);
+guint           events_get_switches        (Events *self);
+void            events_set_external_switches
+                                           (Events  *self,
+                                            guint    switches,
+                                            gboolean seed);
+gboolean        events_add_fd              (Events     *self,
+                                            int         fd,
+                                            const char *name);
 
 G_END_DECLS
 
@@ -11,13 +11,49 @@
 #include "alsa.h"
 #include "events.h"
 #include "headphone-manager.h"
+#include "jack.h"
 #include "mpris.h"
+#include "service.h"
+#include "startup.h"
+#include "stats.h"
+
+#define MAX_ACTIONS 4
+#define PLAYER_CONTENT_TYPE "audio/mp3"
+
+typedef enum {
+    ACTION_VOLUME_SWITCH,
+    ACTION_LAUNCH_PLAYER,
+    ACTION_MPRIS_PLAY,
+    ACTION_MPRIS_PAUSE
+} Action;
+
+struct ActionPlan {
+    Action actions[MAX_ACTIONS];
+    guint  count;
+};
 
 struct _HeadphoneManagerPrivate {
     Alsa *alsa;
     Events *events;
+    Jack *jack;
     Mpris *mpris;
+    Service *service;
     GSettings *settings;
+    /* Components not on the input path, built once the loop runs */
+    guint init_id;
+
+    /* Compiled from settings, for unplug (0) and plug (1) */
+    struct ActionPlan plans[2];
+    gboolean fast_volume_switch;
+
+    /* Default player, resolved ahead of time and dropped on changes */
+    GAppInfo        *app_info;
+    GAppInfoMonitor *app_info_monitor;
+    GCancellable    *cancellable;
+    /* Separate, a stale resolution is dropped without aborting launches */
+    GCancellable    *resolve_cancellable;
+    gboolean         app_info_resolving;
+    gboolean         launch_pending;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -27,40 +63,367 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (HeadphoneManager)
 )
 
+static void finish_init (HeadphoneManager *self);
+
+static void
+on_headphone_edge (Events   *events,
+                   gboolean  headphone_state,
+                   gint64    timestamp,
+                   gpointer  user_data)
+{
+    HeadphoneManager *self = HEADPHONE_MANAGER (user_data);
+
+    if (!self->priv->fast_volume_switch)
+        return;
+
+    finish_init (self);
+    alsa_volume_switch (self->priv->alsa, headphone_state);
+
+    stats_record (
+        STATS_STAGE_FAST_VOLUME_SWITCH, g_get_monotonic_time () - timestamp
+    );
+}
+
+static void
+on_player_launched (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    if (!g_app_info_launch_uris_finish (G_APP_INFO (source_object),
+                                        res, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't launch player: %s", error->message);
+    }
+}
+
+static void resolve_player (HeadphoneManager *self);
+
+static void
+launch_player (HeadphoneManager *self)
+{
+    if (self->priv->app_info == NULL) {
+        /* Launched once resolved */
+        self->priv->launch_pending = TRUE;
+        resolve_player (self);
+        return;
+    }
+
+    g_app_info_launch_uris_async (
+        self->priv->app_info,
+        NULL,
+        NULL,
+        self->priv->cancellable,
+        on_player_launched,
+        self
+    );
+}
+
+static void
+on_player_resolved (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+    HeadphoneManager *self;
+    g_autoptr (GError) error = NULL;
+    GAppInfo *app_info;
+
+    app_info = g_app_info_get_default_for_type_finish (res, &error);
+
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    self = HEADPHONE_MANAGER (user_data);
+    self->priv->app_info_resolving = FALSE;
+    self->priv->app_info = app_info;
+
+    if (self->priv->app_info == NULL) {
+        g_warning ("Can't find default player: %s",
+                   error != NULL ? error->message : PLAYER_CONTENT_TYPE);
+        self->priv->launch_pending = FALSE;
+        return;
+    }
+
+    if (self->priv->launch_pending) {
+        self->priv->launch_pending = FALSE;
+        launch_player (self);
+    }
+}
+
+static void
+resolve_player (HeadphoneManager *self)
+{
+    if (self->priv->app_info != NULL || self->priv->app_info_resolving)
+        return;
+
+    self->priv->app_info_resolving = TRUE;
+
+    g_app_info_get_default_for_type_async (
+        PLAYER_CONTENT_TYPE,
+        FALSE,
+        self->priv->resolve_cancellable,
+        on_player_resolved,
+        self
+    );
+}
+
+static void
+on_app_info_changed (GAppInfoMonitor *monitor,
+                     gpointer         user_data)
+{
+    HeadphoneManager *self = HEADPHONE_MANAGER (user_data);
+    guint i;
+
+    g_clear_object (&self->priv->app_info);
+
+    /* A resolution in flight may have read stale databases */
+    if (self->priv->app_info_resolving) {
+        g_cancellable_cancel (self->priv->resolve_cancellable);
+        g_object_unref (self->priv->resolve_cancellable);
+        self->priv->resolve_cancellable = g_cancellable_new ();
+        self->priv->app_info_resolving = FALSE;
+    }
+
+    for (i = 0; i < self->priv->plans[TRUE].count; i++) {
+        if (self->priv->plans[TRUE].actions[i] == ACTION_LAUNCH_PLAYER)
+            resolve_player (self);
+    }
+}
+
+static void
+add_action (struct ActionPlan *plan,
+            Action             action)
+{
+    g_return_if_fail (plan->count < MAX_ACTIONS);
+
+    plan->actions[plan->count++] = action;
+}
+
+static void
+compile_plans (HeadphoneManager *self)
+{
+    gboolean restore_sound_level = g_settings_get_boolean (
+        self->priv->settings, "restore-sound-level"
+    );
+    gboolean launch_player = g_settings_get_boolean (
+        self->priv->settings, "launch-player"
+    );
+    gboolean pause_mpris = g_settings_get_boolean (
+        self->priv->settings, "pause-mpris"
+    );
+    struct ActionPlan *unplug = &self->priv->plans[FALSE];
+    struct ActionPlan *plug = &self->priv->plans[TRUE];
+
+    unplug->count = 0;
+    plug->count = 0;
+
+    if (restore_sound_level) {
+        add_action (unplug, ACTION_VOLUME_SWITCH);
+        add_action (plug, ACTION_VOLUME_SWITCH);
+    }
+
+    if (launch_player) {
+        add_action (plug, ACTION_LAUNCH_PLAYER);
+        resolve_player (self);
+    }
+
+    if (pause_mpris) {
+        add_action (unplug, ACTION_MPRIS_PAUSE);
+        add_action (plug, ACTION_MPRIS_PLAY);
+    }
+
+    self->priv->fast_volume_switch = restore_sound_level &&
+        g_settings_get_boolean (self->priv->settings, "fast-volume-switch");
+}
+
+static void
+on_settings_changed (GSettings  *settings,
+                     const char *key,
+                     gpointer    user_data)
+{
+    compile_plans (HEADPHONE_MANAGER (user_data));
+}
+
 static void
 on_headphone_state_changed (Events *events,
                             gboolean  headphone_state,
                             gpointer  user_data)
 {
     HeadphoneManager *self = HEADPHONE_MANAGER (user_data);
+    const struct ActionPlan *plan = &self->priv->plans[headphone_state != FALSE];
+    gint64 timestamp;
+    guint i;
 
-    if (g_settings_get_boolean(self->priv->settings, "restore-sound-level"))
-        alsa_volume_switch (self->priv->alsa);
+    events_get_headphone_state (events, &timestamp);
+    stats_record (STATS_STAGE_DISPATCH, g_get_monotonic_time () - timestamp);
 
-    if (headphone_state &&
-            g_settings_get_boolean(self->priv->settings, "launch-player")) {
-        GAppInfo *app_info = g_app_info_get_default_for_type (
-            "audio/mp3", FALSE
-        );
-        if (app_info != NULL)
-            g_app_info_launch (app_info, NULL, NULL, NULL);
-    }
+    finish_init (self);
 
-    if (headphone_state &&
-            g_settings_get_boolean(self->priv->settings, "pause-mpris")) {
-        mpris_play (self->priv->mpris);
-    } else {
-        mpris_pause (self->priv->mpris);
+    for (i = 0; i < plan->count; i++) {
+        switch (plan->actions[i]) {
+        case ACTION_VOLUME_SWITCH:
+            alsa_volume_switch (self->priv->alsa, headphone_state);
+            break;
+        case ACTION_LAUNCH_PLAYER:
+            launch_player (self);
+            break;
+        case ACTION_MPRIS_PLAY:
+            mpris_play (self->priv->mpris);
+            break;
+        case ACTION_MPRIS_PAUSE:
+            mpris_pause (self->priv->mpris);
+            break;
+        default:
+            break;
+        }
     }
 }
 
+static void
+on_jack_switches_changed (Jack     *jack,
+                          guint     old_switches,
+                          guint     switches,
+                          gpointer  user_data)
+{
+    HeadphoneManager *self = HEADPHONE_MANAGER (user_data);
+
+    events_set_external_switches (self->priv->events, switches, FALSE);
+}
+
+static void
+setup_detection (HeadphoneManager *self)
+{
+    g_auto (GStrv) backends = g_settings_get_strv (
+        self->priv->settings, "detection-backends"
+    );
+    g_autofree char *input_dir = g_settings_get_string (
+        self->priv->settings, "input-dir"
+    );
+
+    self->priv->events = EVENTS (g_object_new (
+        TYPE_EVENTS,
+        "scan", g_strv_contains ((const char * const *) backends, "evdev"),
+        "input-dir", input_dir,
+        NULL
+    ));
+
+    if (!g_strv_contains ((const char * const *) backends, "alsa-jack"))
+        return;
+
+    /* Jack controls feed events, sharing debounce and signals */
+    self->priv->jack = JACK (jack_new ());
+    events_set_external_switches (
+        self->priv->events, jack_get_switches (self->priv->jack), TRUE
+    );
+    g_signal_connect (
+        self->priv->jack,
+        "switches-changed",
+        G_CALLBACK (on_jack_switches_changed),
+        self
+    );
+}
+
+static void
+finish_init (HeadphoneManager *self)
+{
+    g_autofree char *card = NULL;
+    g_auto (GStrv) plug_elements = NULL;
+    g_auto (GStrv) unplug_elements = NULL;
+
+    if (self->priv->service != NULL)
+        return;
+
+    g_clear_handle_id (&self->priv->init_id, g_source_remove);
+
+    /* Only configured mixers are opened */
+    card = g_settings_get_string (self->priv->settings, "card");
+    plug_elements = g_settings_get_strv (self->priv->settings, "plug-elements");
+    unplug_elements = g_settings_get_strv (
+        self->priv->settings, "unplug-elements"
+    );
+    self->priv->alsa = ALSA (g_object_new (
+        TYPE_ALSA,
+        "card", card,
+        "plug-elements", plug_elements,
+        "unplug-elements", unplug_elements,
+        NULL
+    ));
+
+    g_settings_bind (
+        self->priv->settings,
+        "card",
+        self->priv->alsa,
+        "card",
+        G_SETTINGS_BIND_GET
+    );
+
+    g_settings_bind (
+        self->priv->settings,
+        "plug-elements",
+        self->priv->alsa,
+        "plug-elements",
+        G_SETTINGS_BIND_GET
+    );
+
+    g_settings_bind (
+        self->priv->settings,
+        "unplug-elements",
+        self->priv->alsa,
+        "unplug-elements",
+        G_SETTINGS_BIND_GET
+    );
+    startup_mark ("alsa");
+
+    self->priv->mpris = MPRIS (mpris_new ());
+
+    g_settings_bind (
+        self->priv->settings,
+        "mpris-timeout",
+        self->priv->mpris,
+        "timeout",
+        G_SETTINGS_BIND_GET
+    );
+    startup_mark ("mpris");
+
+    self->priv->service = SERVICE (service_new (self->priv->events));
+    startup_mark ("service");
+}
+
+static gboolean
+on_init (gpointer user_data)
+{
+    HeadphoneManager *self = HEADPHONE_MANAGER (user_data);
+
+    self->priv->init_id = 0;
+    finish_init (self);
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
 headphone_manager_dispose (GObject *headphone_manager)
 {
     HeadphoneManager *self = HEADPHONE_MANAGER (headphone_manager);
 
+    g_clear_handle_id (&self->priv->init_id, g_source_remove);
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    g_cancellable_cancel (self->priv->resolve_cancellable);
+    g_clear_object (&self->priv->resolve_cancellable);
+    if (self->priv->app_info_monitor != NULL)
+        g_signal_handlers_disconnect_by_data (
+            self->priv->app_info_monitor, self
+        );
+    g_clear_object (&self->priv->app_info_monitor);
+    g_clear_object (&self->priv->app_info);
+
     g_clear_object (&self->priv->alsa);
     g_clear_object (&self->priv->mpris);
+    g_clear_object (&self->priv->service);
+    if (self->priv->jack != NULL)
+        g_signal_handlers_disconnect_by_data (self->priv->jack, self);
+    g_clear_object (&self->priv->jack);
     g_clear_object (&self->priv->events);
     g_clear_object (&self->priv->settings);
 
@@ -87,11 +450,44 @@ static void
 headphone_manager_init (HeadphoneManager *self)
 {
     self->priv = headphone_manager_get_instance_private (self);
+    self->priv->app_info = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->resolve_cancellable = g_cancellable_new ();
+    self->priv->app_info_resolving = FALSE;
+    self->priv->launch_pending = FALSE;
+    self->priv->jack = NULL;
+    self->priv->alsa = NULL;
+    self->priv->mpris = NULL;
+    self->priv->service = NULL;
+    self->priv->app_info_monitor = g_app_info_monitor_get ();
+    g_signal_connect (
+        self->priv->app_info_monitor,
+        "changed",
+        G_CALLBACK (on_app_info_changed),
+        self
+    );
 
-    self->priv->alsa = ALSA (alsa_new ());
-    self->priv->events = EVENTS (events_new ());
-    self->priv->mpris = MPRIS (mpris_new ());
     self->priv->settings = g_settings_new (APP_ID);
+    startup_mark ("settings");
+
+    setup_detection (self);
+    startup_mark ("input");
+
+    compile_plans (self);
+    g_signal_connect (
+        self->priv->settings,
+        "changed",
+        G_CALLBACK (on_settings_changed),
+        self
+    );
+
+    g_settings_bind (
+        self->priv->settings,
+        "debounce",
+        self->priv->events,
+        "debounce",
+        G_SETTINGS_BIND_GET
+    );
 
     g_signal_connect (
         self->priv->events,
@@ -99,6 +495,16 @@ headphone_manager_init (HeadphoneManager *self)
         G_CALLBACK (on_headphone_state_changed),
         self
     );
+
+    g_signal_connect (
+        self->priv->events,
+        "headphone-edge",
+        G_CALLBACK (on_headphone_edge),
+        self
+    );
+
+    /* Built before, if a jack event comes first */
+    self->priv->init_id = g_idle_add (on_init, self);
 }
 
 /**
@@ -0,0 +1,493 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include <alsa/asoundlib.h>
+
+#include "config.h"
+#include "jack.h"
+#include "stats.h"
+#include "utils.h"
+
+#define JACK_SUFFIX " Jack"
+#define SWITCH_BIT(code) (1u << (code))
+
+/* signals */
+enum
+{
+    SWITCHES_CHANGED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+/*
+ * Jack kcontrol name parts, first match wins, and matching switches.
+ * Names may carry a location, like "Front Headphone Jack", and a
+ * combined "Headset Jack" reports both headphone and microphone.
+ */
+static const struct {
+    const char *pattern;
+    guint       switches;
+} jack_switches[] = {
+    { "Headset Mic",   SWITCH_BIT (SW_MICROPHONE_INSERT) },
+    { "Headphone Mic", SWITCH_BIT (SW_MICROPHONE_INSERT) },
+    { "Headphone",     SWITCH_BIT (SW_HEADPHONE_INSERT) },
+    { "Headset",       SWITCH_BIT (SW_HEADPHONE_INSERT) |
+                       SWITCH_BIT (SW_MICROPHONE_INSERT) },
+    { "Mic",           SWITCH_BIT (SW_MICROPHONE_INSERT) },
+    { "Line Out",      SWITCH_BIT (SW_LINEOUT_INSERT) },
+    { "HDMI/DP",       SWITCH_BIT (SW_VIDEOOUT_INSERT) },
+};
+
+struct Kcontrol {
+    unsigned int numid;
+    guint        switches;
+    gboolean     inserted;
+};
+
+struct Card {
+    Jack      *self;
+    char      *name;
+    snd_ctl_t *ctl;
+    GSource   *source;
+    /* Tags of the control poll fds in source */
+    GList     *tags;
+    GList     *kcontrols;
+};
+
+typedef struct {
+    GSource      source;
+    struct Card *card;
+} JackSource;
+
+struct _JackPrivate {
+    GList *cards;
+    /* Bitmap of inserted jacks, by evdev switch code */
+    guint  switches;
+};
+
+G_DEFINE_TYPE_WITH_CODE (
+    Jack,
+    jack,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (Jack)
+)
+
+static gboolean
+get_jack_switches (const char *name,
+                   guint      *switches)
+{
+    guint i;
+
+    if (!g_str_has_suffix (name, JACK_SUFFIX))
+        return FALSE;
+
+    for (i = 0; i < G_N_ELEMENTS (jack_switches); i++) {
+        if (strstr (name, jack_switches[i].pattern) != NULL) {
+            *switches = jack_switches[i].switches;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+read_kcontrol (struct Card     *card,
+               struct Kcontrol *kcontrol)
+{
+    snd_ctl_elem_value_t *value;
+    int err;
+
+    snd_ctl_elem_value_alloca (&value);
+    snd_ctl_elem_value_set_interface (value, SND_CTL_ELEM_IFACE_CARD);
+    snd_ctl_elem_value_set_numid (value, kcontrol->numid);
+
+    if ((err = snd_ctl_elem_read (card->ctl, value)) < 0) {
+        g_warning ("Can't read jack %u on %s: %s",
+                   kcontrol->numid, card->name, snd_strerror (err));
+        return;
+    }
+
+    kcontrol->inserted = snd_ctl_elem_value_get_boolean (value, 0);
+}
+
+static struct Kcontrol *
+find_kcontrol (struct Card  *card,
+               unsigned int  numid)
+{
+    struct Kcontrol *kcontrol;
+
+    GFOREACH (card->kcontrols, kcontrol) {
+        if (kcontrol->numid == numid)
+            return kcontrol;
+    }
+
+    return NULL;
+}
+
+static void
+add_kcontrol (struct Card          *card,
+              unsigned int          numid,
+              snd_ctl_elem_iface_t  iface,
+              const char           *name)
+{
+    struct Kcontrol *kcontrol;
+    guint switches;
+
+    if (iface != SND_CTL_ELEM_IFACE_CARD ||
+            !get_jack_switches (name, &switches) ||
+            find_kcontrol (card, numid) != NULL)
+        return;
+
+    kcontrol = g_new0 (struct Kcontrol, 1);
+    kcontrol->numid = numid;
+    kcontrol->switches = switches;
+    read_kcontrol (card, kcontrol);
+
+    card->kcontrols = g_list_append (card->kcontrols, kcontrol);
+
+    g_message ("Jack added: %s on %s", name, card->name);
+}
+
+static void
+index_kcontrols (struct Card *card)
+{
+    snd_ctl_elem_list_t *list;
+    unsigned int i;
+
+    snd_ctl_elem_list_alloca (&list);
+    memset (list, 0, snd_ctl_elem_list_sizeof ());
+
+    if (snd_ctl_elem_list (card->ctl, list) < 0 ||
+            snd_ctl_elem_list_alloc_space (
+                list, snd_ctl_elem_list_get_count (list)) < 0)
+        return;
+
+    if (snd_ctl_elem_list (card->ctl, list) == 0) {
+        for (i = 0; i < snd_ctl_elem_list_get_used (list); i++)
+            add_kcontrol (
+                card,
+                snd_ctl_elem_list_get_numid (list, i),
+                snd_ctl_elem_list_get_interface (list, i),
+                snd_ctl_elem_list_get_name (list, i)
+            );
+    }
+
+    snd_ctl_elem_list_free_space (list);
+}
+
+static guint
+get_card_switches (struct Card *card)
+{
+    struct Kcontrol *kcontrol;
+    guint switches = 0;
+
+    GFOREACH (card->kcontrols, kcontrol) {
+        if (kcontrol->inserted)
+            switches |= kcontrol->switches;
+    }
+
+    return switches;
+}
+
+static guint
+get_switches (Jack *self)
+{
+    struct Card *card;
+    guint switches = 0;
+
+    /* A jack reported by any card is inserted */
+    GFOREACH (self->priv->cards, card)
+        switches |= get_card_switches (card);
+
+    return switches;
+}
+
+static void
+update_switches (Jack *self)
+{
+    guint old_switches = self->priv->switches;
+    guint switches = get_switches (self);
+
+    if (switches == old_switches)
+        return;
+
+    self->priv->switches = switches;
+
+    g_signal_emit (
+        self,
+        signals[SWITCHES_CHANGED],
+        0,
+        old_switches,
+        switches
+    );
+}
+
+static void
+handle_event (struct Card     *card,
+              snd_ctl_event_t *event)
+{
+    struct Kcontrol *kcontrol;
+    unsigned int numid;
+    unsigned int mask;
+
+    if (snd_ctl_event_get_type (event) != SND_CTL_EVENT_ELEM)
+        return;
+
+    numid = snd_ctl_event_elem_get_numid (event);
+    mask = snd_ctl_event_elem_get_mask (event);
+
+    if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+        kcontrol = find_kcontrol (card, numid);
+        if (kcontrol != NULL) {
+            card->kcontrols = g_list_remove (card->kcontrols, kcontrol);
+            g_free (kcontrol);
+        }
+        return;
+    }
+
+    if (mask & SND_CTL_EVENT_MASK_ADD)
+        add_kcontrol (
+            card,
+            numid,
+            snd_ctl_event_elem_get_interface (event),
+            snd_ctl_event_elem_get_name (event)
+        );
+
+    if (mask & SND_CTL_EVENT_MASK_VALUE) {
+        kcontrol = find_kcontrol (card, numid);
+        if (kcontrol != NULL)
+            read_kcontrol (card, kcontrol);
+    }
+}
+
+static void
+clear_card (struct Card *card)
+{
+    if (card->source != NULL) {
+        g_source_destroy (card->source);
+        g_source_unref (card->source);
+    }
+
+    g_list_free (card->tags);
+    g_list_free_full (card->kcontrols, g_free);
+    g_clear_pointer (&card->ctl, snd_ctl_close);
+    g_free (card->name);
+    g_free (card);
+}
+
+static GIOCondition
+get_card_condition (struct Card *card)
+{
+    GIOCondition condition = 0;
+    gpointer tag;
+
+    GFOREACH (card->tags, tag)
+        condition |= g_source_query_unix_fd (card->source, tag);
+
+    return condition;
+}
+
+static gboolean
+jack_source_dispatch (GSource     *source,
+                      GSourceFunc  callback,
+                      gpointer     user_data)
+{
+    struct Card *card = ((JackSource *) source)->card;
+    Jack *self = card->self;
+    snd_ctl_event_t *event;
+    int err;
+
+    snd_ctl_event_alloca (&event);
+    stats_count (STATS_COUNTER_INPUT_WAKEUPS, 1);
+
+    /* Control is non blocking, read until drained */
+    while ((err = snd_ctl_read (card->ctl, event)) > 0)
+        handle_event (card, event);
+
+    if (err == -ENODEV ||
+            get_card_condition (card) & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+        /* Card unplugged, its jacks go with it */
+        g_message ("Jack card removed: %s", card->name);
+        self->priv->cards = g_list_remove (self->priv->cards, card);
+        clear_card (card);
+        update_switches (self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    update_switches (self);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs jack_source_funcs = {
+    NULL,
+    NULL,
+    jack_source_dispatch,
+    NULL,
+    NULL,
+    NULL
+};
+
+static void
+watch_card (struct Card *card)
+{
+    struct pollfd *fds;
+    int i, count;
+
+    count = snd_ctl_poll_descriptors_count (card->ctl);
+    if (count <= 0)
+        return;
+
+    fds = g_new0 (struct pollfd, count);
+    count = snd_ctl_poll_descriptors (card->ctl, fds, count);
+
+    card->source = g_source_new (&jack_source_funcs, sizeof (JackSource));
+    ((JackSource *) card->source)->card = card;
+    g_source_set_name (card->source, "headphone-manager jack");
+
+    for (i = 0; i < count; i++)
+        card->tags = g_list_prepend (
+            card->tags,
+            g_source_add_unix_fd (
+                card->source, fds[i].fd, (GIOCondition) fds[i].events
+            )
+        );
+
+    g_source_attach (card->source, NULL);
+
+    g_free (fds);
+}
+
+static void
+open_card (Jack *self,
+           int   index)
+{
+    struct Card *card;
+    int err;
+
+    card = g_new0 (struct Card, 1);
+    card->self = self;
+    card->name = g_strdup_printf ("hw:%d", index);
+
+    if ((err = snd_ctl_open (&card->ctl, card->name, SND_CTL_NONBLOCK)) < 0) {
+        g_warning ("Can't open control %s: %s", card->name, snd_strerror (err));
+        clear_card (card);
+        return;
+    }
+
+    index_kcontrols (card);
+
+    /* Only cards reporting jacks are kept open */
+    if (card->kcontrols == NULL) {
+        clear_card (card);
+        return;
+    }
+
+    if ((err = snd_ctl_subscribe_events (card->ctl, 1)) < 0) {
+        g_warning ("Can't subscribe to %s: %s", card->name, snd_strerror (err));
+        clear_card (card);
+        return;
+    }
+
+    watch_card (card);
+
+    self->priv->cards = g_list_append (self->priv->cards, card);
+}
+
+static void
+jack_dispose (GObject *jack)
+{
+    Jack *self = JACK (jack);
+
+    g_list_free_full (self->priv->cards, (GDestroyNotify) clear_card);
+    self->priv->cards = NULL;
+
+    G_OBJECT_CLASS (jack_parent_class)->dispose (jack);
+}
+
+static void
+jack_finalize (GObject *jack)
+{
+    G_OBJECT_CLASS (jack_parent_class)->finalize (jack);
+}
+
+static void
+jack_class_init (JackClass *klass)
+{
+    GObjectClass *object_class;
+
+    object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = jack_dispose;
+    object_class->finalize = jack_finalize;
+
+    signals[SWITCHES_CHANGED] = g_signal_new (
+        "switches-changed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        2,
+        G_TYPE_UINT,
+        G_TYPE_UINT
+    );
+}
+
+static void
+jack_init (Jack *self)
+{
+    int index = -1;
+
+    self->priv = jack_get_instance_private (self);
+    self->priv->cards = NULL;
+    self->priv->switches = 0;
+
+    while (snd_card_next (&index) == 0 && index >= 0)
+        open_card (self, index);
+
+    /* Initial state, not a change */
+    self->priv->switches = get_switches (self);
+}
+
+/**
+ * jack_new:
+ *
+ * Creates a new #Jack, watching jack kcontrols of every sound card
+ *
+ * Returns: (transfer full): a new #Jack
+ *
+ **/
+GObject *
+jack_new (void)
+{
+    GObject *jack;
+
+    jack = g_object_new (TYPE_JACK, NULL);
+
+    return jack;
+}
+
+/**
+ * jack_get_switches:
+ *
+ * Get inserted jacks
+ *
+ * @self: a #Jack
+ *
+ * Returns: bitmap of inserted jacks, indexed by SW_* code
+ *
+ **/
+guint
+jack_get_switches (Jack *self)
+{
+    return self->priv->switches;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef JACK_H
+#define JACK_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#define TYPE_JACK \
+    (jack_get_type ())
+#define JACK(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST \
+    ((obj), TYPE_JACK, Jack))
+#define JACK_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_CAST \
+    ((cls), TYPE_JACK, JackClass))
+#define IS_JACK(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE \
+    ((obj), TYPE_JACK))
+#define IS_JACK_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_TYPE \
+    ((cls), TYPE_JACK))
+#define JACK_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS \
+    ((obj), TYPE_JACK, JackClass))
+
+G_BEGIN_DECLS
+
+typedef struct _Jack Jack;
+typedef struct _JackClass JackClass;
+typedef struct _JackPrivate JackPrivate;
+
+struct _Jack {
+    GObject parent;
+    JackPrivate *priv;
+};
+
+struct _JackClass {
+    GObjectClass parent_class;
+};
+
+GType           jack_get_type              (void) G_GNUC_CONST;
+
+GObject*        jack_new                   (void);
+guint           jack_get_switches          (Jack *self);
+
+G_END_DECLS
+
+#endif
+
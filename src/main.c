@@ -3,11 +3,79 @@
  */
 
 #include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
 #include <gio/gio.h>
+#include <glib-unix.h>
 
 #include "headphone-manager.h"
+#include "recorder.h"
+#include "startup.h"
+#include "stats.h"
 #include "config.h"
 
+/* Process exits if teardown takes longer, in seconds */
+#define SHUTDOWN_WATCHDOG 2
+
+static void
+on_shutdown_watchdog (int signum)
+{
+    /* Teardown hung, report it as a failure */
+    _exit (EXIT_FAILURE);
+}
+
+static gboolean
+on_quit_signal (gpointer user_data)
+{
+    static gboolean stopping = FALSE;
+    struct sigaction action = { 0 };
+
+    /* Deadline is set by the first request */
+    if (stopping)
+        return G_SOURCE_CONTINUE;
+    stopping = TRUE;
+
+    g_main_loop_quit ((GMainLoop *) user_data);
+    startup_notify ("STOPPING=1");
+
+    /* Teardown never blocks for longer */
+    action.sa_handler = on_shutdown_watchdog;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGALRM, &action, NULL);
+    alarm (SHUTDOWN_WATCHDOG);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Objects cancel their pending operations on dispose, run completions
+ * already queued, never wait for others: process exit releases them.
+ */
+static void
+drain_main_context (void)
+{
+    while (g_main_context_iteration (NULL, FALSE))
+        continue;
+}
+
+static gboolean
+on_ready (gpointer user_data)
+{
+    /* Input is watched, other components follow from idle */
+    startup_notify ("READY=1");
+    startup_mark ("ready");
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_stats_signal (gpointer user_data)
+{
+    stats_dump ();
+
+    return G_SOURCE_CONTINUE;
+}
+
 gint
 main (gint argc, gchar * argv[])
 {
@@ -16,8 +84,14 @@ main (gint argc, gchar * argv[])
     g_autoptr (GOptionContext) context = NULL;
     g_autoptr (GError) error = NULL;
     gboolean version = FALSE;
+    gboolean stats = FALSE;
+    gboolean dump_recorder = FALSE;
+    gboolean startup_profile = FALSE;
     GOptionEntry main_entries[] = {
         {"version", 0, 0, G_OPTION_ARG_NONE, &version, "Show version"},
+        {"stats", 0, 0, G_OPTION_ARG_NONE, &stats, "Print latency statistics and counters on exit"},
+        {"dump-recorder", 0, 0, G_OPTION_ARG_NONE, &dump_recorder, "Print flight recorder and exit"},
+        {"startup-profile", 0, 0, G_OPTION_ARG_NONE, &startup_profile, "Print time spent in each startup phase"},
         {NULL}
     };
 
@@ -34,13 +108,37 @@ main (gint argc, gchar * argv[])
         return EXIT_SUCCESS;
     }
 
+    if (dump_recorder)
+        return recorder_dump () ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    startup_begin (startup_profile);
+
+    recorder_open ();
+    startup_mark ("recorder");
+
     headphone_manager = headphone_manager_new ();
 
     loop = g_main_loop_new (NULL, FALSE);
+    stats_watch_main_loop ();
+
+    /* Before idle sources, they are deferred initialisation */
+    g_idle_add_full (G_PRIORITY_DEFAULT, on_ready, NULL, NULL);
+
+    g_unix_signal_add (SIGINT, on_quit_signal, loop);
+    g_unix_signal_add (SIGTERM, on_quit_signal, loop);
+    g_unix_signal_add (SIGUSR1, on_stats_signal, NULL);
+
     g_main_loop_run (loop);
 
-    g_clear_pointer (&loop, g_main_loop_unref);
+    if (stats)
+        stats_dump ();
+
     g_clear_object (&headphone_manager);
+    /* Loop is kept for quit signals received meanwhile */
+    drain_main_context ();
+    g_clear_pointer (&loop, g_main_loop_unref);
+
+    recorder_close ();
 
     return EXIT_SUCCESS;
 }
@@ -7,42 +7,125 @@
 
 #include "config.h"
 #include "mpris.h"
-#include "utils.h"
+#include "recorder.h"
+#include "stats.h"
 
 #define DBUS_FREEDESKTOP_NAME           "org.freedesktop.DBus"
 #define DBUS_FREEDESKTOP_PATH           "/org/freedesktop/DBus"
 #define DBUS_FREEDESKTOP_INTERFACE      "org.freedesktop.DBus"
+#define DBUS_PROPERTIES_INTERFACE       "org.freedesktop.DBus.Properties"
 
 #define DBUS_MPRIS_PATH                 "/org/mpris/MediaPlayer2"
 #define DBUS_MPRIS_INTERFACE            "org.mpris.MediaPlayer2"
 #define DBUS_MPRIS_PLAYER_INTERFACE     "org.mpris.MediaPlayer2.Player"
 #define DBUS_MPRIS_PREFIX               "org.mpris.MediaPlayer2."
 
+#define DEFAULT_TIMEOUT 1000
+
+/* signals */
+enum
+{
+    CALLS_FINISHED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+/* properties */
+enum
+{
+    PROP_0,
+    PROP_TIMEOUT,
+    LAST_PROP
+};
+
+static GParamSpec *properties[LAST_PROP];
+
+typedef enum {
+    PLAYBACK_UNKNOWN,
+    PLAYBACK_STOPPED,
+    PLAYBACK_PAUSED,
+    PLAYBACK_PLAYING
+} PlaybackStatus;
+
+typedef enum {
+    PLAYER_CALL_PAUSE,
+    PLAYER_CALL_PLAY,
+    PLAYER_CALL_LAST
+} PlayerCall;
+
+static const char *player_calls[PLAYER_CALL_LAST] = { "Pause", "Play" };
+
+struct Calls {
+    Mpris      *self;
+    PlayerCall  call;
+    gint64      start;
+    guint       count;
+    guint       pending;
+    guint       failed;
+    gint64      slowest;
+};
+
+struct Call {
+    struct Calls *calls;
+    char         *name;
+};
+
 struct Player {
-    GDBusProxy *bus;
-    char       *name;
-    gboolean    was_playing;
+    Mpris          *self;
+    char           *name;
+    char           *owner;
+    PlaybackStatus  status;
+    /* Cancels queries still in flight when player goes away */
+    GCancellable   *cancellable;
 };
 
 struct _MprisPrivate {
-    GDBusProxy *dbus_proxy;
-
-    GList *players;
+    GDBusConnection *connection;
+    GCancellable    *cancellable;
+    guint            name_owner_id;
+    guint            properties_id;
+    guint            timeout;
+
+    /* well-known name -> struct Player */
+    GHashTable *players;
+    /* unique owner -> GPtrArray of struct Player, a process may own
+     * several well-known names */
+    GHashTable *owners;
+    /* well-known name -> struct Player, players currently playing */
+    GHashTable *playing;
+    /* well-known name -> struct Player, players paused by us */
+    GHashTable *paused;
 };
 
 G_DEFINE_TYPE_WITH_CODE (Mpris, mpris, G_TYPE_OBJECT,
     G_ADD_PRIVATE (Mpris))
 
+static PlaybackStatus
+get_playback_status (const char *status)
+{
+    if (g_strcmp0 (status, "Playing") == 0)
+        return PLAYBACK_PLAYING;
+    if (g_strcmp0 (status, "Paused") == 0)
+        return PLAYBACK_PAUSED;
+    if (g_strcmp0 (status, "Stopped") == 0)
+        return PLAYBACK_STOPPED;
+
+    return PLAYBACK_UNKNOWN;
+}
+
 static struct Player *
-get_player (GDBusProxy *bus,
+get_player (Mpris      *self,
             const char *name)
 {
     struct Player *player;
 
     player = g_malloc (sizeof (struct Player));
-    player->bus = bus;
+    player->self = self;
     player->name = g_strdup (name);
-    player->was_playing = FALSE;
+    player->owner = NULL;
+    player->status = PLAYBACK_UNKNOWN;
+    player->cancellable = g_cancellable_new ();
 
     return player;
 }
@@ -50,39 +133,177 @@ get_player (GDBusProxy *bus,
 static void
 clear_player (struct Player *player)
 {
-    g_clear_object (&player->bus);
+    g_cancellable_cancel (player->cancellable);
+    g_clear_object (&player->cancellable);
     g_free (player->name);
+    g_free (player->owner);
     g_free (player);
 }
 
 static void
-add_player (Mpris      *self,
-            const char *name)
+set_status (struct Player  *player,
+            PlaybackStatus  status)
+{
+    Mpris *self = player->self;
+
+    player->status = status;
+
+    if (status == PLAYBACK_PLAYING)
+        g_hash_table_replace (self->priv->playing, player->name, player);
+    else
+        g_hash_table_remove (self->priv->playing, player->name);
+}
+
+static void
+set_owner (struct Player *player,
+           const char    *owner)
+{
+    Mpris *self = player->self;
+    GPtrArray *players;
+
+    if (player->owner != NULL) {
+        players = g_hash_table_lookup (self->priv->owners, player->owner);
+        if (players != NULL &&
+                g_ptr_array_remove (players, player) &&
+                players->len == 0)
+            g_hash_table_remove (self->priv->owners, player->owner);
+    }
+
+    g_free (player->owner);
+    player->owner = g_strdup (owner);
+
+    if (player->owner == NULL)
+        return;
+
+    players = g_hash_table_lookup (self->priv->owners, player->owner);
+    if (players == NULL) {
+        players = g_ptr_array_new ();
+        g_hash_table_insert (
+            self->priv->owners, g_strdup (player->owner), players
+        );
+    }
+    g_ptr_array_add (players, player);
+}
+
+static void
+on_playback_status (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
 {
-    GDBusProxy *player_bus;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GVariant) value = NULL;
+    g_autoptr (GVariant) status = NULL;
     struct Player *player;
 
-    if (!g_str_has_prefix (name, DBUS_MPRIS_PREFIX))
+    value = g_dbus_connection_call_finish (
+        G_DBUS_CONNECTION (source_object), res, &error
+    );
+
+    /* Player is gone, don't touch it */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
         return;
 
-    g_message ("Player added: %s", name);
+    player = user_data;
 
-    player_bus = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SESSION,
-        0,
-        NULL,
-        name,
+    if (value == NULL) {
+        g_warning ("Can't get %s status: %s", player->name, error->message);
+        return;
+    }
+
+    g_variant_get (value, "(v)", &status);
+
+    if (g_variant_is_of_type (status, G_VARIANT_TYPE_STRING))
+        set_status (player, get_playback_status (
+            g_variant_get_string (status, NULL)
+        ));
+}
+
+static void
+query_status (struct Player *player)
+{
+    g_dbus_connection_call (
+        player->self->priv->connection,
+        player->name,
         DBUS_MPRIS_PATH,
-        DBUS_MPRIS_PLAYER_INTERFACE,
-        NULL,
-        NULL
+        DBUS_PROPERTIES_INTERFACE,
+        "Get",
+        g_variant_new ("(ss)", DBUS_MPRIS_PLAYER_INTERFACE, "PlaybackStatus"),
+        G_VARIANT_TYPE ("(v)"),
+        G_DBUS_CALL_FLAGS_NO_AUTO_START,
+        -1,
+        player->cancellable,
+        on_playback_status,
+        player
+    );
+}
+
+static void
+on_name_owner (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GVariant) value = NULL;
+    const char *owner;
+
+    value = g_dbus_connection_call_finish (
+        G_DBUS_CONNECTION (source_object), res, &error
+    );
+
+    if (value == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get player owner: %s", error->message);
+        return;
+    }
+
+    g_variant_get (value, "(&s)", &owner);
+    set_owner (user_data, owner);
+}
+
+static void
+query_owner (struct Player *player)
+{
+    g_dbus_connection_call (
+        player->self->priv->connection,
+        DBUS_FREEDESKTOP_NAME,
+        DBUS_FREEDESKTOP_PATH,
+        DBUS_FREEDESKTOP_INTERFACE,
+        "GetNameOwner",
+        g_variant_new ("(s)", player->name),
+        G_VARIANT_TYPE ("(s)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        player->cancellable,
+        on_name_owner,
+        player
     );
+}
 
-    g_return_if_fail (player_bus != NULL);
+static void
+add_player (Mpris      *self,
+            const char *name,
+            const char *owner)
+{
+    struct Player *player;
 
-    player = get_player (player_bus, name);
+    if (!g_str_has_prefix (name, DBUS_MPRIS_PREFIX))
+        return;
+
+    if (g_hash_table_contains (self->priv->players, name))
+        return;
 
-    self->priv->players = g_list_append (self->priv->players, player);
+    g_message ("Player added: %s", name);
+
+    player = get_player (self, name);
+    g_hash_table_insert (self->priv->players, player->name, player);
+
+    /* Queries run concurrently, player state fills in as they resolve */
+    if (owner != NULL)
+        set_owner (player, owner);
+    else
+        query_owner (player);
+
+    query_status (player);
 }
 
 static void
@@ -91,90 +312,275 @@ del_player (Mpris      *self,
 {
     struct Player *player;
 
-    if (!g_str_has_prefix (name, DBUS_MPRIS_PREFIX))
+    player = g_hash_table_lookup (self->priv->players, name);
+    if (player == NULL)
         return;
 
     g_message ("Player removed: %s", name);
 
-    GFOREACH (self->priv->players, player) {
-        if (g_strcmp0 (player->name, name) == 0) {
-            self->priv->players = g_list_remove_all (
-                self->priv->players, player
-            );
-            clear_player (player);
-            return;
-        }
-    }
+    set_owner (player, NULL);
+    g_hash_table_remove (self->priv->playing, name);
+    g_hash_table_remove (self->priv->paused, name);
+
+    /* Frees player */
+    g_hash_table_remove (self->priv->players, name);
 }
 
 static void
-add_players (Mpris *self)
+move_player (Mpris         *self,
+             struct Player *player,
+             const char    *new_owner)
 {
+    g_message ("Player moved: %s", player->name);
+
+    g_cancellable_cancel (player->cancellable);
+    g_object_unref (player->cancellable);
+    player->cancellable = g_cancellable_new ();
+
+    set_owner (player, new_owner);
+    set_status (player, PLAYBACK_UNKNOWN);
+    g_hash_table_remove (self->priv->paused, player->name);
+
+    query_status (player);
+}
+
+static void
+on_list_names (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    Mpris *self;
     g_autoptr (GError) error = NULL;
     g_autoptr (GVariant) value = NULL;
-    g_autoptr (GVariantIter) iter;
+    g_autoptr (GVariantIter) iter = NULL;
     const char *player;
 
-    value = g_dbus_proxy_call_sync (
-        self->priv->dbus_proxy,
-        "ListNames",
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
+    value = g_dbus_connection_call_finish (
+        G_DBUS_CONNECTION (source_object), res, &error
     );
 
-    if (error != NULL) {
-        g_warning ("Can't get MPRIS players: %s", error->message);
+    if (value == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get MPRIS players: %s", error->message);
         return;
     }
 
+    self = MPRIS (user_data);
+
     g_variant_get (value, "(as)", &iter);
     while (g_variant_iter_loop (iter, "&s", &player))
-        add_player (self, player);
+        add_player (self, player, NULL);
 }
 
 static void
-on_dbus_signal (GDBusProxy *proxy,
-                const char *sender_name,
-                const char *signal_name,
-                GVariant   *parameters,
-                gpointer    user_data)
+add_players (Mpris *self)
 {
-    Mpris *self = MPRIS (user_data);
+    g_dbus_connection_call (
+        self->priv->connection,
+        DBUS_FREEDESKTOP_NAME,
+        DBUS_FREEDESKTOP_PATH,
+        DBUS_FREEDESKTOP_INTERFACE,
+        "ListNames",
+        NULL,
+        G_VARIANT_TYPE ("(as)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_list_names,
+        self
+    );
+}
 
-    if (g_strcmp0 (signal_name, "NameOwnerChanged") == 0) {
-        const char *name = NULL;
-        const char *old_owner = NULL;
-        const char *new_owner = NULL;
+static void
+on_name_owner_changed (GDBusConnection *connection,
+                       const char      *sender_name,
+                       const char      *object_path,
+                       const char      *interface_name,
+                       const char      *signal_name,
+                       GVariant        *parameters,
+                       gpointer         user_data)
+{
+    Mpris *self = MPRIS (user_data);
+    const char *name = NULL;
+    const char *old_owner = NULL;
+    const char *new_owner = NULL;
+
+    g_variant_get (parameters,
+        "(&s&s&s)",
+        &name,
+        &old_owner,
+        &new_owner
+    );
 
-        g_variant_get (parameters,
-            "(&s&s&s)",
-            &name,
-            &old_owner,
-            &new_owner
+    if (*old_owner != '\0' && *new_owner != '\0') {
+        struct Player *player = g_hash_table_lookup (
+            self->priv->players, name
         );
 
-        if (old_owner != NULL && strlen (old_owner) > 0) {
-            del_player (self, name);
-        }
-        if (new_owner != NULL && strlen (new_owner) > 0) {
-            add_player (self, name);
+        /* Handover, entry is updated in place. A name we never saw,
+         * missed at startup or filtered, is added as new */
+        if (player != NULL)
+            move_player (self, player, new_owner);
+        else
+            add_player (self, name, new_owner);
+    } else if (*old_owner != '\0') {
+        del_player (self, name);
+    } else if (*new_owner != '\0') {
+        add_player (self, name, new_owner);
+    }
+}
+
+static void
+on_properties_changed (GDBusConnection *connection,
+                       const char      *sender_name,
+                       const char      *object_path,
+                       const char      *interface_name,
+                       const char      *signal_name,
+                       GVariant        *parameters,
+                       gpointer         user_data)
+{
+    Mpris *self = MPRIS (user_data);
+    g_autoptr (GVariant) changed = NULL;
+    g_autoptr (GVariantIter) invalidated = NULL;
+    GPtrArray *players;
+    const char *status;
+    const char *property;
+    guint i;
+
+    players = g_hash_table_lookup (self->priv->owners, sender_name);
+    if (players == NULL)
+        return;
+
+    g_variant_get (parameters, "(&s@a{sv}as)", NULL, &changed, &invalidated);
+
+    /* Signal can't tell which name it was sent for, update them all */
+    if (g_variant_lookup (changed, "PlaybackStatus", "&s", &status)) {
+        for (i = 0; i < players->len; i++)
+            set_status (
+                g_ptr_array_index (players, i),
+                get_playback_status (status)
+            );
+        return;
+    }
+
+    while (g_variant_iter_next (invalidated, "&s", &property)) {
+        if (g_strcmp0 (property, "PlaybackStatus") == 0) {
+            for (i = 0; i < players->len; i++)
+                query_status (g_ptr_array_index (players, i));
+            return;
         }
     }
 }
 
+static void
+on_session_bus (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    Mpris *self;
+    g_autoptr (GError) error = NULL;
+    GDBusConnection *connection;
+
+    connection = g_bus_get_finish (res, &error);
+
+    if (connection == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't connect to session bus: %s", error->message);
+        return;
+    }
+
+    self = MPRIS (user_data);
+    self->priv->connection = connection;
+
+    /* Subscribe first so players appearing during listing are not lost */
+    self->priv->name_owner_id = g_dbus_connection_signal_subscribe (
+        connection,
+        DBUS_FREEDESKTOP_NAME,
+        DBUS_FREEDESKTOP_INTERFACE,
+        "NameOwnerChanged",
+        DBUS_FREEDESKTOP_PATH,
+        DBUS_MPRIS_INTERFACE,
+        G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE,
+        on_name_owner_changed,
+        self,
+        NULL
+    );
+
+    /* One subscription serves every player */
+    self->priv->properties_id = g_dbus_connection_signal_subscribe (
+        connection,
+        NULL,
+        DBUS_PROPERTIES_INTERFACE,
+        "PropertiesChanged",
+        DBUS_MPRIS_PATH,
+        DBUS_MPRIS_PLAYER_INTERFACE,
+        G_DBUS_SIGNAL_FLAGS_NONE,
+        on_properties_changed,
+        self,
+        NULL
+    );
+
+    add_players (self);
+}
+
+static void
+mpris_set_property (GObject      *object,
+                    guint         property_id,
+                    const GValue *value,
+                    GParamSpec   *pspec)
+{
+    Mpris *self = MPRIS (object);
+
+    switch (property_id) {
+    case PROP_TIMEOUT:
+        self->priv->timeout = g_value_get_uint (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+mpris_get_property (GObject    *object,
+                    guint       property_id,
+                    GValue     *value,
+                    GParamSpec *pspec)
+{
+    Mpris *self = MPRIS (object);
+
+    switch (property_id) {
+    case PROP_TIMEOUT:
+        g_value_set_uint (value, self->priv->timeout);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
 static void
 mpris_dispose (GObject *mpris)
 {
     Mpris *self = MPRIS (mpris);
-    struct Player *player;
 
-    GFOREACH (self->priv->players, player)
-        clear_player (player);
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+
+    if (self->priv->connection != NULL) {
+        g_dbus_connection_signal_unsubscribe (
+            self->priv->connection, self->priv->name_owner_id
+        );
+        g_dbus_connection_signal_unsubscribe (
+            self->priv->connection, self->priv->properties_id
+        );
+    }
+    g_clear_object (&self->priv->connection);
 
-    g_clear_object (&self->priv->dbus_proxy);
+    g_clear_pointer (&self->priv->paused, g_hash_table_unref);
+    g_clear_pointer (&self->priv->playing, g_hash_table_unref);
+    g_clear_pointer (&self->priv->owners, g_hash_table_unref);
+    g_clear_pointer (&self->priv->players, g_hash_table_unref);
 
     G_OBJECT_CLASS (mpris_parent_class)->dispose (mpris);
 }
@@ -182,10 +588,6 @@ mpris_dispose (GObject *mpris)
 static void
 mpris_finalize (GObject *mpris)
 {
-    Mpris *self = MPRIS (mpris);
-
-    g_list_free (self->priv->players);
-
     G_OBJECT_CLASS (mpris_parent_class)->finalize (mpris);
 }
 
@@ -195,32 +597,59 @@ mpris_class_init (MprisClass *klass)
     GObjectClass *object_class;
 
     object_class = G_OBJECT_CLASS (klass);
+    object_class->set_property = mpris_set_property;
+    object_class->get_property = mpris_get_property;
     object_class->dispose = mpris_dispose;
     object_class->finalize = mpris_finalize;
+
+    properties[PROP_TIMEOUT] = g_param_spec_uint (
+        "timeout",
+        "Timeout",
+        "Time in milliseconds players have to answer a Play/Pause call",
+        1, G_MAXINT, DEFAULT_TIMEOUT,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+    );
+
+    g_object_class_install_properties (object_class, LAST_PROP, properties);
+
+    signals[CALLS_FINISHED] = g_signal_new (
+        "calls-finished",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        4,
+        G_TYPE_STRING,
+        G_TYPE_UINT,
+        G_TYPE_UINT,
+        G_TYPE_INT64
+    );
 }
 
 static void
 mpris_init (Mpris *self)
 {
     self->priv = mpris_get_instance_private (self);
-
-    self->priv->dbus_proxy = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SESSION,
-        0,
-        NULL,
-        DBUS_FREEDESKTOP_NAME,
-        DBUS_FREEDESKTOP_PATH,
-        DBUS_FREEDESKTOP_INTERFACE,
-        NULL,
-        NULL
+    self->priv->connection = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->name_owner_id = 0;
+    self->priv->properties_id = 0;
+    self->priv->timeout = DEFAULT_TIMEOUT;
+    self->priv->players = g_hash_table_new_full (
+        g_str_hash, g_str_equal, NULL, (GDestroyNotify) clear_player
     );
+    self->priv->owners = g_hash_table_new_full (
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref
+    );
+    self->priv->playing = g_hash_table_new (g_str_hash, g_str_equal);
+    self->priv->paused = g_hash_table_new (g_str_hash, g_str_equal);
 
-    add_players (self);
-
-    g_signal_connect (
-        self->priv->dbus_proxy,
-        "g-signal",
-        G_CALLBACK (on_dbus_signal),
+    /* Discovery runs from the main loop, it never blocks construction */
+    g_bus_get (
+        G_BUS_TYPE_SESSION,
+        self->priv->cancellable,
+        on_session_bus,
         self
     );
 }
@@ -246,6 +675,123 @@ mpris_new (void)
     return mpris;
 }
 
+static void
+on_call_reply (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    struct Call *call = user_data;
+    struct Calls *calls = call->calls;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GDBusMessage) reply = NULL;
+    gint64 elapsed = g_get_monotonic_time () - calls->start;
+
+    reply = g_dbus_connection_send_message_with_reply_finish (
+        G_DBUS_CONNECTION (source_object), res, &error
+    );
+
+    if (reply != NULL)
+        g_dbus_message_to_gerror (reply, &error);
+
+    if (error != NULL) {
+        calls->failed++;
+        g_warning ("%s %s failed after %" G_GINT64_FORMAT " µs: %s",
+                   player_calls[calls->call], call->name,
+                   elapsed, error->message);
+    } else {
+        g_debug ("%s %s: %" G_GINT64_FORMAT " µs",
+                 player_calls[calls->call], call->name, elapsed);
+    }
+
+    calls->slowest = MAX (calls->slowest, elapsed);
+    stats_record (STATS_STAGE_MPRIS_REPLY, elapsed);
+
+    g_free (call->name);
+    g_free (call);
+
+    if (--calls->pending > 0)
+        return;
+
+    g_message ("%s: %u players, %u failed, %" G_GINT64_FORMAT " µs",
+               player_calls[calls->call], calls->count,
+               calls->failed, calls->slowest);
+
+    recorder_record (
+        RECORDER_MPRIS_REPLY,
+        g_get_monotonic_time (),
+        calls->call,
+        calls->failed,
+        MIN (calls->slowest, G_MAXINT32)
+    );
+
+    g_signal_emit (
+        calls->self,
+        signals[CALLS_FINISHED],
+        0,
+        player_calls[calls->call],
+        calls->count,
+        calls->failed,
+        calls->slowest
+    );
+
+    g_object_unref (calls->self);
+    g_free (calls);
+}
+
+static void
+call_players (Mpris      *self,
+              GHashTable *players,
+              PlayerCall  player_call)
+{
+    GHashTableIter iter;
+    struct Player *player;
+    struct Calls *calls;
+
+    if (g_hash_table_size (players) == 0)
+        return;
+
+    calls = g_new0 (struct Calls, 1);
+    calls->self = g_object_ref (self);
+    calls->call = player_call;
+    calls->start = g_get_monotonic_time ();
+    calls->count = g_hash_table_size (players);
+    calls->pending = calls->count;
+
+    recorder_record (
+        RECORDER_MPRIS_CALL, calls->start, player_call, calls->count, 0
+    );
+
+    /* All calls are in flight at once, each bounded by the same deadline */
+    g_hash_table_iter_init (&iter, players);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &player)) {
+        struct Call *call = g_new0 (struct Call, 1);
+        GDBusMessage *message = g_dbus_message_new_method_call (
+            player->name,
+            DBUS_MPRIS_PATH,
+            DBUS_MPRIS_PLAYER_INTERFACE,
+            player_calls[player_call]
+        );
+
+        g_dbus_message_set_flags (message, G_DBUS_MESSAGE_FLAGS_NO_AUTO_START);
+
+        call->calls = calls;
+        call->name = g_strdup (player->name);
+
+        g_dbus_connection_send_message_with_reply (
+            self->priv->connection,
+            message,
+            G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+            self->priv->timeout,
+            NULL,
+            NULL,
+            on_call_reply,
+            call
+        );
+
+        g_object_unref (message);
+    }
+}
+
 /**
  * mpris_play:
  *
@@ -257,22 +803,12 @@ mpris_new (void)
 void
 mpris_play (Mpris *self)
 {
-    struct Player *player;
+    gint64 start = g_get_monotonic_time ();
 
-    GFOREACH (self->priv->players, player) {
-        if (player->was_playing) {
-             g_dbus_proxy_call (
-                player->bus,
-                "Play",
-                NULL,
-                G_DBUS_CALL_FLAGS_NONE,
-                -1,
-                NULL,
-                NULL,
-                NULL
-            );
-        }
-    }
+    call_players (self, self->priv->paused, PLAYER_CALL_PLAY);
+    g_hash_table_remove_all (self->priv->paused);
+
+    stats_record (STATS_STAGE_MPRIS_PLAY, g_get_monotonic_time () - start);
 }
 
 /**
@@ -286,34 +822,50 @@ mpris_play (Mpris *self)
 void
 mpris_pause (Mpris *self)
 {
-        struct Player *player;
+    GHashTableIter iter;
+    struct Player *player;
+    gint64 start = g_get_monotonic_time ();
 
-    GFOREACH (self->priv->players, player) {
-        GVariant *value;
+    g_hash_table_remove_all (self->priv->paused);
 
-        value = g_dbus_proxy_get_cached_property (
-            player->bus, "PlaybackStatus"
-        );
+    /* Only players known to be playing are visited */
+    g_hash_table_iter_init (&iter, self->priv->playing);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &player))
+        g_hash_table_replace (self->priv->paused, player->name, player);
 
-        if (value == NULL)
-            continue;
-
-        player->was_playing = g_strcmp0 (
-            g_variant_get_string (value, NULL), "Playing"
-        ) == 0;
-        g_variant_unref (value);
-
-        if (player->was_playing) {
-             g_dbus_proxy_call (
-                player->bus,
-                "Pause",
-                NULL,
-                G_DBUS_CALL_FLAGS_NONE,
-                -1,
-                NULL,
-                NULL,
-                NULL
-            );
-        }
-    }
-}
\ No newline at end of file
+    call_players (self, self->priv->paused, PLAYER_CALL_PAUSE);
+
+    stats_record (STATS_STAGE_MPRIS_PAUSE, g_get_monotonic_time () - start);
+}
+
+/**
+ * mpris_get_n_players:
+ *
+ * Get number of known mpris players
+ *
+ * @self: a #Mpris
+ *
+ * Returns: number of players
+ *
+ **/
+guint
+mpris_get_n_players (Mpris *self)
+{
+    return g_hash_table_size (self->priv->players);
+}
+
+/**
+ * mpris_get_n_playing:
+ *
+ * Get number of mpris players known to be playing
+ *
+ * @self: a #Mpris
+ *
+ * Returns: number of playing players
+ *
+ **/
+guint
+mpris_get_n_playing (Mpris *self)
+{
+    return g_hash_table_size (self->priv->playing);
+}
@@ -46,6 +46,8 @@ GType       mpris_get_type       (void) G_GNUC_CONST;
 GObject*    mpris_new            (void);
 void        mpris_play           (Mpris *self);
 void        mpris_pause          (Mpris *self);
+guint       mpris_get_n_players  (Mpris *self);
+guint       mpris_get_n_playing  (Mpris *self);
 
 G_END_DECLS
 
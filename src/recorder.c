@@ -0,0 +1,335 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "recorder.h"
+
+#define RECORDER_FILE "headphone-manager.recorder"
+#define RECORDER_MAGIC 0x52464d48
+#define RECORDER_VERSION 2
+#define RECORDER_ENTRIES 4096
+
+struct Entry {
+    gint64  time;
+    /* 0 while being written, then position in recorder starting at 1 */
+    guint32 seq;
+    guint16 type;
+    guint16 code;
+    gint32  value;
+    gint32  extra;
+};
+
+struct Header {
+    guint32 magic;
+    guint32 version;
+    guint32 entry_size;
+    guint32 capacity;
+    /* seq of last complete entry */
+    guint32 head;
+    guint32 padding;
+};
+
+struct Recorder {
+    struct Header header;
+    struct Entry  entries[RECORDER_ENTRIES];
+};
+
+static const char *type_names[RECORDER_LAST] = {
+    [RECORDER_SWITCH]      = "switch",
+    [RECORDER_DROPPED]     = "dropped",
+    [RECORDER_TRANSITION]  = "transition",
+    [RECORDER_MIXER_WRITE] = "mixer-write",
+    [RECORDER_MPRIS_CALL]  = "mpris-call",
+    [RECORDER_MPRIS_REPLY] = "mpris-reply",
+    [RECORDER_SYNC]        = "sync",
+};
+
+static const char *mpris_calls[] = { "Pause", "Play" };
+
+/* Shared mapping, written by the main loop only */
+static struct Recorder *recorder = NULL;
+
+static char *
+get_path (void)
+{
+    return g_build_filename (g_get_user_runtime_dir (), RECORDER_FILE, NULL);
+}
+
+static gboolean
+is_valid (const struct Header *header)
+{
+    return header->magic == RECORDER_MAGIC &&
+        header->version == RECORDER_VERSION &&
+        header->entry_size == sizeof (struct Entry) &&
+        header->capacity == RECORDER_ENTRIES;
+}
+
+/**
+ * recorder_open:
+ *
+ * Map flight recorder file from XDG_RUNTIME_DIR, keeping entries left by
+ * a previous run
+ *
+ **/
+void
+recorder_open (void)
+{
+    g_autofree char *path = get_path ();
+    struct Recorder *map;
+    int fd;
+
+    if (recorder != NULL)
+        return;
+
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        g_warning ("Can't open flight recorder %s", path);
+        return;
+    }
+
+    if (ftruncate (fd, sizeof (struct Recorder)) < 0) {
+        g_warning ("Can't resize flight recorder %s", path);
+        close (fd);
+        return;
+    }
+
+    map = mmap (
+        NULL, sizeof (struct Recorder),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    close (fd);
+
+    if (map == MAP_FAILED) {
+        g_warning ("Can't map flight recorder %s", path);
+        return;
+    }
+
+    if (!is_valid (&map->header)) {
+        memset (map, 0, sizeof (struct Recorder));
+        map->header.magic = RECORDER_MAGIC;
+        map->header.version = RECORDER_VERSION;
+        map->header.entry_size = sizeof (struct Entry);
+        map->header.capacity = RECORDER_ENTRIES;
+    }
+
+    recorder = map;
+
+    /* Entries left by a previous run keep their own sync */
+    recorder_sync ();
+}
+
+/**
+ * recorder_close:
+ *
+ * Unmap flight recorder, file is kept for recorder_dump()
+ *
+ **/
+void
+recorder_close (void)
+{
+    if (recorder == NULL)
+        return;
+
+    munmap (recorder, sizeof (struct Recorder));
+    recorder = NULL;
+}
+
+/**
+ * recorder_sync:
+ *
+ * Record current monotonic to real time offset. Monotonic time stops
+ * while suspended, so entries are decoded with the nearest preceding
+ * sync: call on open and on resume.
+ *
+ **/
+void
+recorder_sync (void)
+{
+    gint64 time = g_get_monotonic_time ();
+    gint64 offset = g_get_real_time () - time;
+
+    recorder_record (
+        RECORDER_SYNC,
+        time,
+        0,
+        (gint32) (offset >> 32),
+        (gint32) (offset & G_MAXUINT32)
+    );
+}
+
+/**
+ * recorder_record:
+ *
+ * Add an entry to flight recorder, overwriting oldest one when full.
+ * Only stores to the shared mapping, no syscall.
+ *
+ * @type: a #RecorderType
+ * @time: monotonic time in µs
+ * @code: type specific code
+ * @value: type specific value
+ * @extra: type specific value
+ *
+ **/
+void
+recorder_record (RecorderType type,
+                 gint64       time,
+                 guint16      code,
+                 gint32       value,
+                 gint32       extra)
+{
+    struct Entry *entry;
+    guint32 seq;
+
+    if (recorder == NULL)
+        return;
+
+    seq = recorder->header.head + 1;
+    entry = &recorder->entries[(seq - 1) % RECORDER_ENTRIES];
+
+    /* A crash while writing leaves an entry the decoder skips */
+    __atomic_store_n (&entry->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    entry->time = time;
+    entry->type = type;
+    entry->code = code;
+    entry->value = value;
+    entry->extra = extra;
+
+    __atomic_store_n (&entry->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n (&recorder->header.head, seq, __ATOMIC_RELEASE);
+}
+
+static gint64
+get_sync_offset (const struct Entry *entry)
+{
+    return ((gint64) entry->value << 32) | (guint32) entry->extra;
+}
+
+static void
+print_entry (const struct Entry *entry,
+             gint64              realtime_offset,
+             gint64              previous)
+{
+    g_autoptr (GDateTime) date = NULL;
+    g_autofree char *formatted = NULL;
+    gint64 realtime = entry->time + realtime_offset;
+    const char *call = mpris_calls[entry->code % G_N_ELEMENTS (mpris_calls)];
+
+    date = g_date_time_new_from_unix_local (realtime / G_USEC_PER_SEC);
+    formatted = g_date_time_format (date, "%F %T");
+
+    g_print (
+        "%s.%06d %+12.3f ms  %-12s",
+        formatted,
+        (int) (realtime % G_USEC_PER_SEC),
+        previous < 0 ? 0.0 : (entry->time - previous) / 1000.0,
+        entry->type < RECORDER_LAST ? type_names[entry->type] : "unknown"
+    );
+
+    switch ((RecorderType) entry->type) {
+    case RECORDER_SWITCH:
+        g_print ("code %u value %d\n", entry->code, entry->value);
+        break;
+    case RECORDER_DROPPED:
+        g_print ("\n");
+        break;
+    case RECORDER_TRANSITION:
+        g_print ("%s, switches 0x%x\n",
+                 entry->value ? "plugged" : "unplugged", entry->extra);
+        break;
+    case RECORDER_MIXER_WRITE:
+        g_print ("element %08x volume %d for %s\n",
+                 (guint32) entry->extra, entry->value,
+                 entry->code ? "headphone" : "speaker");
+        break;
+    case RECORDER_MPRIS_CALL:
+        g_print ("%s %d players\n", call, entry->value);
+        break;
+    case RECORDER_MPRIS_REPLY:
+        g_print ("%s %d failed, slowest %d µs\n", call,
+                 entry->value, entry->extra);
+        break;
+    case RECORDER_SYNC:
+        g_print ("real time offset %" G_GINT64_FORMAT " µs\n",
+                 get_sync_offset (entry));
+        break;
+    case RECORDER_LAST:
+    default:
+        g_print ("code %u value %d extra %d\n",
+                 entry->code, entry->value, entry->extra);
+        break;
+    }
+}
+
+/**
+ * recorder_dump:
+ *
+ * Print flight recorder entries from XDG_RUNTIME_DIR, oldest first
+ *
+ * Returns: TRUE if recorder file was read
+ *
+ **/
+gboolean
+recorder_dump (void)
+{
+    g_autofree char *path = get_path ();
+    g_autofree char *contents = NULL;
+    g_autoptr (GError) error = NULL;
+    const struct Recorder *map;
+    gint64 previous = -1;
+    gint64 offset;
+    guint32 seq, first;
+    gsize length;
+
+    if (!g_file_get_contents (path, &contents, &length, &error)) {
+        g_printerr ("%s\n", error->message);
+        return FALSE;
+    }
+
+    map = (const struct Recorder *) contents;
+    if (length != sizeof (struct Recorder) || !is_valid (&map->header)) {
+        g_printerr ("Not a flight recorder: %s\n", path);
+        return FALSE;
+    }
+
+    first = map->header.head > RECORDER_ENTRIES ?
+        map->header.head - RECORDER_ENTRIES + 1 : 1;
+
+    /* Oldest entries may have lost their sync to wrapping: use the first
+     * one left, or ours if none */
+    offset = g_get_real_time () - g_get_monotonic_time ();
+    for (seq = first; seq <= map->header.head && seq != 0; seq++) {
+        const struct Entry *entry =
+            &map->entries[(seq - 1) % RECORDER_ENTRIES];
+
+        if (entry->seq == seq && entry->type == RECORDER_SYNC) {
+            offset = get_sync_offset (entry);
+            break;
+        }
+    }
+
+    for (seq = first; seq <= map->header.head && seq != 0; seq++) {
+        const struct Entry *entry =
+            &map->entries[(seq - 1) % RECORDER_ENTRIES];
+
+        /* Overwritten or torn entry */
+        if (entry->seq != seq)
+            continue;
+
+        if (entry->type == RECORDER_SYNC)
+            offset = get_sync_offset (entry);
+
+        print_entry (entry, offset, previous);
+        previous = entry->time;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    /* Raw EV_SW event: code, value */
+    RECORDER_SWITCH,
+    /* SYN_DROPPED read, switch state will be resynced */
+    RECORDER_DROPPED,
+    /* Settled switches emitted: value is headphone state, extra the
+       switches bitmap */
+    RECORDER_TRANSITION,
+    /* Mixer element write: code is headphone state, value volume,
+       extra element id, a hash of its element@card name */
+    RECORDER_MIXER_WRITE,
+    /* MPRIS calls sent: code 0 Pause, 1 Play, value is player count */
+    RECORDER_MPRIS_CALL,
+    /* MPRIS calls finished: code as above, value failed count,
+       extra slowest reply in µs */
+    RECORDER_MPRIS_REPLY,
+    /* Monotonic to real time offset in µs, as of this entry: value
+       holds high 32 bits, extra low 32 bits */
+    RECORDER_SYNC,
+    RECORDER_LAST
+} RecorderType;
+
+void            recorder_open           (void);
+void            recorder_close          (void);
+void            recorder_sync           (void);
+void            recorder_record         (RecorderType type,
+                                         gint64       time,
+                                         guint16      code,
+                                         gint32       value,
+                                         gint32       extra);
+gboolean        recorder_dump           (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <gio/gio.h>
+
+#include "config.h"
+#include "service.h"
+#include "stats.h"
+
+#define DBUS_SERVICE_PATH               "/org/adishatz/HeadphoneManager"
+#define DBUS_SERVICE_INTERFACE          "org.adishatz.HeadphoneManager"
+#define DBUS_PROPERTIES_INTERFACE       "org.freedesktop.DBus.Properties"
+
+static const char introspection_xml[] =
+    "<node>"
+    "  <interface name='" DBUS_SERVICE_INTERFACE "'>"
+    "    <method name='GetHeadphoneState'>"
+    "      <arg name='present' type='b' direction='out'/>"
+    "      <arg name='timestamp' type='x' direction='out'/>"
+    "    </method>"
+    "    <method name='GetCounters'>"
+    "      <arg name='counters' type='a{st}' direction='out'/>"
+    "    </method>"
+    "    <property name='HeadphonePresent' type='b' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+/* properties */
+enum
+{
+    PROP_0,
+    PROP_EVENTS,
+    LAST_PROP
+};
+
+static GParamSpec *properties[LAST_PROP];
+
+struct _ServicePrivate {
+    Events          *events;
+    guint            owner_id;
+    GDBusConnection *connection;
+    GDBusNodeInfo   *node_info;
+    guint            registration_id;
+
+    /* Last emitted state and its monotonic time in µs */
+    gboolean present;
+    gint64   timestamp;
+};
+
+G_DEFINE_TYPE_WITH_CODE (
+    Service,
+    service,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (Service)
+)
+
+static void
+on_method_call (GDBusConnection       *connection,
+                const char            *sender,
+                const char            *object_path,
+                const char            *interface_name,
+                const char            *method_name,
+                GVariant              *parameters,
+                GDBusMethodInvocation *invocation,
+                gpointer               user_data)
+{
+    Service *self = SERVICE (user_data);
+
+    if (g_strcmp0 (method_name, "GetHeadphoneState") == 0) {
+        g_dbus_method_invocation_return_value (
+            invocation,
+            g_variant_new ("(bx)", self->priv->present, self->priv->timestamp)
+        );
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "GetCounters") == 0) {
+        GVariant *counters = stats_get_counters ();
+
+        g_dbus_method_invocation_return_value (
+            invocation, g_variant_new_tuple (&counters, 1)
+        );
+        return;
+    }
+
+    g_dbus_method_invocation_return_error (
+        invocation,
+        G_DBUS_ERROR,
+        G_DBUS_ERROR_UNKNOWN_METHOD,
+        "Unknown method %s",
+        method_name
+    );
+}
+
+static GVariant *
+on_get_property (GDBusConnection  *connection,
+                 const char       *sender,
+                 const char       *object_path,
+                 const char       *interface_name,
+                 const char       *property_name,
+                 GError          **error,
+                 gpointer          user_data)
+{
+    Service *self = SERVICE (user_data);
+
+    if (g_strcmp0 (property_name, "HeadphonePresent") == 0)
+        return g_variant_new_boolean (self->priv->present);
+
+    g_set_error (
+        error,
+        G_DBUS_ERROR,
+        G_DBUS_ERROR_UNKNOWN_PROPERTY,
+        "Unknown property %s",
+        property_name
+    );
+
+    return NULL;
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    on_method_call,
+    on_get_property,
+    NULL
+};
+
+static void
+emit_present (Service *self)
+{
+    GVariantBuilder changed;
+
+    if (self->priv->registration_id == 0)
+        return;
+
+    g_variant_builder_init (&changed, G_VARIANT_TYPE ("a{sv}"));
+    g_variant_builder_add (
+        &changed,
+        "{sv}",
+        "HeadphonePresent",
+        g_variant_new_boolean (self->priv->present)
+    );
+
+    g_dbus_connection_emit_signal (
+        self->priv->connection,
+        NULL,
+        DBUS_SERVICE_PATH,
+        DBUS_PROPERTIES_INTERFACE,
+        "PropertiesChanged",
+        g_variant_new ("(sa{sv}as)", DBUS_SERVICE_INTERFACE, &changed, NULL),
+        NULL
+    );
+}
+
+static void
+on_headphone_state_changed (Events   *events,
+                            gboolean  state,
+                            gpointer  user_data)
+{
+    Service *self = SERVICE (user_data);
+
+    events_get_headphone_state (events, &self->priv->timestamp);
+
+    if (self->priv->present == state)
+        return;
+
+    self->priv->present = state;
+    emit_present (self);
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const char      *name,
+                 gpointer         user_data)
+{
+    Service *self = SERVICE (user_data);
+    g_autoptr (GError) error = NULL;
+
+    self->priv->connection = g_object_ref (connection);
+    self->priv->registration_id = g_dbus_connection_register_object (
+        connection,
+        DBUS_SERVICE_PATH,
+        self->priv->node_info->interfaces[0],
+        &interface_vtable,
+        self,
+        NULL,
+        &error
+    );
+
+    if (self->priv->registration_id == 0)
+        g_warning ("Can't register %s: %s", DBUS_SERVICE_PATH, error->message);
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+              const char      *name,
+              gpointer         user_data)
+{
+    g_warning ("Can't own %s", name);
+}
+
+static void
+service_set_property (GObject      *object,
+                      guint         property_id,
+                      const GValue *value,
+                      GParamSpec   *pspec)
+{
+    Service *self = SERVICE (object);
+
+    switch (property_id) {
+    case PROP_EVENTS:
+        self->priv->events = g_value_dup_object (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+service_get_property (GObject    *object,
+                      guint       property_id,
+                      GValue     *value,
+                      GParamSpec *pspec)
+{
+    Service *self = SERVICE (object);
+
+    switch (property_id) {
+    case PROP_EVENTS:
+        g_value_set_object (value, self->priv->events);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+service_constructed (GObject *service)
+{
+    Service *self = SERVICE (service);
+
+    G_OBJECT_CLASS (service_parent_class)->constructed (service);
+
+    self->priv->present = events_get_headphone_state (
+        self->priv->events, &self->priv->timestamp
+    );
+    g_signal_connect (
+        self->priv->events,
+        "headphone-state-changed",
+        G_CALLBACK (on_headphone_state_changed),
+        self
+    );
+
+    self->priv->owner_id = g_bus_own_name (
+        G_BUS_TYPE_SESSION,
+        APP_ID,
+        G_BUS_NAME_OWNER_FLAGS_NONE,
+        on_bus_acquired,
+        NULL,
+        on_name_lost,
+        self,
+        NULL
+    );
+}
+
+static void
+service_dispose (GObject *service)
+{
+    Service *self = SERVICE (service);
+
+    g_clear_handle_id (&self->priv->owner_id, g_bus_unown_name);
+
+    if (self->priv->registration_id != 0) {
+        g_dbus_connection_unregister_object (
+            self->priv->connection, self->priv->registration_id
+        );
+        self->priv->registration_id = 0;
+    }
+    g_clear_object (&self->priv->connection);
+
+    if (self->priv->events != NULL) {
+        g_signal_handlers_disconnect_by_data (self->priv->events, self);
+        g_clear_object (&self->priv->events);
+    }
+
+    G_OBJECT_CLASS (service_parent_class)->dispose (service);
+}
+
+static void
+service_finalize (GObject *service)
+{
+    Service *self = SERVICE (service);
+
+    g_dbus_node_info_unref (self->priv->node_info);
+
+    G_OBJECT_CLASS (service_parent_class)->finalize (service);
+}
+
+static void
+service_class_init (ServiceClass *klass)
+{
+    GObjectClass *object_class;
+
+    object_class = G_OBJECT_CLASS (klass);
+    object_class->set_property = service_set_property;
+    object_class->get_property = service_get_property;
+    object_class->constructed = service_constructed;
+    object_class->dispose = service_dispose;
+    object_class->finalize = service_finalize;
+
+    properties[PROP_EVENTS] = g_param_spec_object (
+        "events",
+        "Events",
+        "Headphone state source",
+        TYPE_EVENTS,
+        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS
+    );
+
+    g_object_class_install_properties (object_class, LAST_PROP, properties);
+}
+
+static void
+service_init (Service *self)
+{
+    self->priv = service_get_instance_private (self);
+    self->priv->events = NULL;
+    self->priv->owner_id = 0;
+    self->priv->connection = NULL;
+    self->priv->registration_id = 0;
+    self->priv->present = FALSE;
+    self->priv->timestamp = 0;
+    self->priv->node_info = g_dbus_node_info_new_for_xml (
+        introspection_xml, NULL
+    );
+}
+
+/**
+ * service_new:
+ *
+ * Creates a new #Service, owning org.adishatz.HeadphoneManager on
+ * session bus
+ *
+ * @events: a #Events to serve headphone state from
+ *
+ * Returns: (transfer full): a new #Service
+ *
+ **/
+GObject *
+service_new (Events *events)
+{
+    GObject *service;
+
+    service = g_object_new (TYPE_SERVICE, "events", events, NULL);
+
+    return service;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "events.h"
+
+#define TYPE_SERVICE \
+    (service_get_type ())
+#define SERVICE(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST \
+    ((obj), TYPE_SERVICE, Service))
+#define SERVICE_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_CAST \
+    ((cls), TYPE_SERVICE, ServiceClass))
+#define IS_SERVICE(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE \
+    ((obj), TYPE_SERVICE))
+#define IS_SERVICE_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_TYPE \
+    ((cls), TYPE_SERVICE))
+#define SERVICE_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS \
+    ((obj), TYPE_SERVICE, ServiceClass))
+
+G_BEGIN_DECLS
+
+typedef struct _Service Service;
+typedef struct _ServiceClass ServiceClass;
+typedef struct _ServicePrivate ServicePrivate;
+
+struct _Service {
+    GObject parent;
+    ServicePrivate *priv;
+};
+
+struct _ServiceClass {
+    GObjectClass parent_class;
+};
+
+GType           service_get_type           (void) G_GNUC_CONST;
+
+GObject*        service_new                (Events *events);
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,119 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "startup.h"
+
+static gboolean profile = FALSE;
+static gint64 start = 0;
+static gint64 previous = 0;
+
+/**
+ * startup_begin:
+ *
+ * Start timing startup phases
+ *
+ * @enabled: TRUE to print each phase duration as it ends
+ *
+ **/
+void
+startup_begin (gboolean enabled)
+{
+    profile = enabled;
+    start = g_get_monotonic_time ();
+    previous = start;
+}
+
+/**
+ * startup_mark:
+ *
+ * End a startup phase, printed if profiling is enabled
+ *
+ * @phase: name of the phase that just ended
+ *
+ **/
+void
+startup_mark (const char *phase)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (profile)
+        g_print (
+            "%-10s %9.3f ms %9.3f ms total\n",
+            phase,
+            (now - previous) / 1000.0,
+            (now - start) / 1000.0
+        );
+
+    previous = now;
+}
+
+/**
+ * startup_notify:
+ *
+ * Send a state to the service manager, as sd_notify() does, without
+ * depending on libsystemd
+ *
+ * @state: newline separated assignments, like "READY=1"
+ *
+ * Returns: TRUE if @state was sent
+ *
+ **/
+gboolean
+startup_notify (const char *state)
+{
+    const char *socket_path = g_getenv ("NOTIFY_SOCKET");
+    struct sockaddr_un address;
+    socklen_t length;
+    size_t path_length;
+    ssize_t sent;
+    int fd;
+
+    /* Not started by a service manager */
+    if (socket_path == NULL)
+        return FALSE;
+
+    path_length = strlen (socket_path);
+    if ((socket_path[0] != '/' && socket_path[0] != '@') ||
+            path_length >= sizeof (address.sun_path)) {
+        g_warning ("Can't notify %s: invalid socket", socket_path);
+        return FALSE;
+    }
+
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    memcpy (address.sun_path, socket_path, path_length);
+
+    /* Abstract namespace */
+    if (address.sun_path[0] == '@')
+        address.sun_path[0] = '\0';
+
+    length = offsetof (struct sockaddr_un, sun_path) + path_length;
+
+    fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        g_warning ("Can't notify %s: %s", socket_path, g_strerror (errno));
+        return FALSE;
+    }
+
+    sent = sendto (
+        fd, state, strlen (state), MSG_NOSIGNAL,
+        (struct sockaddr *) &address, length
+    );
+    close (fd);
+
+    if (sent < 0) {
+        g_warning ("Can't notify %s: %s", socket_path, g_strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
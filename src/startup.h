@@ -0,0 +1,18 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void            startup_begin           (gboolean    profile);
+void            startup_mark            (const char *phase);
+gboolean        startup_notify          (const char *state);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "stats.h"
+
+#define PROC_SELF_STATUS "/proc/self/status"
+#define PROC_SELF_FD "/proc/self/fd"
+
+/* Bucket n holds durations in [2^n, 2^(n+1)) µs, last one is open ended */
+#define STATS_BUCKETS 24
+
+struct Histogram {
+    const char *name;
+    guint64     count;
+    gint64      sum;
+    gint64      max;
+    guint64     buckets[STATS_BUCKETS];
+};
+
+static struct Histogram histograms[STATS_STAGE_LAST] = {
+    [STATS_STAGE_READ]               = { .name = "read" },
+    [STATS_STAGE_DISPATCH]           = { .name = "dispatch" },
+    [STATS_STAGE_FAST_VOLUME_SWITCH] = { .name = "fast-volume-switch" },
+    [STATS_STAGE_VOLUME_SWITCH]      = { .name = "volume-switch" },
+    [STATS_STAGE_MPRIS_PAUSE]        = { .name = "mpris-pause" },
+    [STATS_STAGE_MPRIS_PLAY]         = { .name = "mpris-play" },
+    [STATS_STAGE_MPRIS_REPLY]        = { .name = "mpris-reply" },
+    [STATS_STAGE_ATTACH]             = { .name = "attach" },
+    [STATS_STAGE_SCAN]               = { .name = "scan" },
+};
+
+static const char *counter_names[STATS_COUNTER_LAST] = {
+    [STATS_COUNTER_LOOP_ITERATIONS] = "loop-iterations",
+    [STATS_COUNTER_INPUT_WAKEUPS]   = "input-wakeups",
+    [STATS_COUNTER_INPUT_SYSCALLS]  = "input-syscalls",
+    [STATS_COUNTER_INPUT_EVENTS]    = "input-events",
+};
+
+static guint64 counters[STATS_COUNTER_LAST];
+
+static GSource *loop_source = NULL;
+
+/* Never ready, only prepared once per main context iteration */
+static gboolean
+loop_source_prepare (GSource *source,
+                     gint    *timeout)
+{
+    counters[STATS_COUNTER_LOOP_ITERATIONS]++;
+    *timeout = -1;
+
+    return FALSE;
+}
+
+static gboolean
+loop_source_dispatch (GSource     *source,
+                      GSourceFunc  callback,
+                      gpointer     user_data)
+{
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs loop_source_funcs = {
+    loop_source_prepare,
+    NULL,
+    loop_source_dispatch,
+    NULL,
+    NULL,
+    NULL
+};
+
+static guint64
+get_status_value (const char *status,
+                  const char *key)
+{
+    const char *line = strstr (status, key);
+
+    if (line == NULL)
+        return 0;
+
+    return g_ascii_strtoull (line + strlen (key), NULL, 10);
+}
+
+static guint64
+get_fd_count (void)
+{
+    g_autoptr (GDir) dir = g_dir_open (PROC_SELF_FD, 0, NULL);
+    guint64 count = 0;
+
+    if (dir == NULL)
+        return 0;
+
+    while (g_dir_read_name (dir) != NULL)
+        count++;
+
+    /* Without the one listing the directory */
+    return count > 0 ? count - 1 : 0;
+}
+
+/**
+ * stats_record:
+ *
+ * Add a duration to a stage histogram
+ *
+ * @stage: a #StatsStage
+ * @elapsed: duration in µs
+ *
+ **/
+void
+stats_record (StatsStage stage,
+              gint64     elapsed)
+{
+    struct Histogram *histogram = &histograms[stage];
+    guint bucket = 0;
+
+    if (elapsed < 0)
+        elapsed = 0;
+
+    if (elapsed > 1)
+        bucket = MIN (g_bit_storage ((guint64) elapsed) - 1, STATS_BUCKETS - 1);
+
+    histogram->count++;
+    histogram->sum += elapsed;
+    histogram->max = MAX (histogram->max, elapsed);
+    histogram->buckets[bucket]++;
+}
+
+/**
+ * stats_count:
+ *
+ * Add to a counter
+ *
+ * @counter: a #StatsCounter
+ * @count: value to add
+ *
+ **/
+void
+stats_count (StatsCounter counter,
+             guint64      count)
+{
+    counters[counter] += count;
+}
+
+/**
+ * stats_watch_main_loop:
+ *
+ * Count default main context iterations
+ *
+ **/
+void
+stats_watch_main_loop (void)
+{
+    if (loop_source != NULL)
+        return;
+
+    loop_source = g_source_new (&loop_source_funcs, sizeof (GSource));
+    g_source_set_name (loop_source, "headphone-manager stats");
+
+    /* Lower priority sources aren't prepared once one is ready */
+    g_source_set_priority (loop_source, G_PRIORITY_HIGH);
+    g_source_attach (loop_source, NULL);
+}
+
+/**
+ * stats_get_counters:
+ *
+ * Get counters and process resources: threads, RSS in kB and open fds
+ *
+ * Returns: (transfer floating): a{st} of counter names and values
+ *
+ **/
+GVariant *
+stats_get_counters (void)
+{
+    g_autofree char *status = NULL;
+    GVariantBuilder builder;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+    for (i = 0; i < STATS_COUNTER_LAST; i++)
+        g_variant_builder_add (&builder, "{st}", counter_names[i], counters[i]);
+
+    if (g_file_get_contents (PROC_SELF_STATUS, &status, NULL, NULL)) {
+        g_variant_builder_add (
+            &builder, "{st}", "threads", get_status_value (status, "Threads:")
+        );
+        g_variant_builder_add (
+            &builder, "{st}", "rss-kb", get_status_value (status, "VmRSS:")
+        );
+    }
+
+    g_variant_builder_add (&builder, "{st}", "fds", get_fd_count ());
+
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * stats_dump:
+ *
+ * Print stage histograms and counters to stdout
+ *
+ **/
+void
+stats_dump (void)
+{
+    g_autoptr (GVariant) values = g_variant_ref_sink (stats_get_counters ());
+    GVariantIter iter;
+    const char *name;
+    guint64 value;
+    guint i, j;
+
+    g_print ("%-20s %10s %10s %10s\n", "stage", "count", "avg µs", "max µs");
+
+    for (i = 0; i < STATS_STAGE_LAST; i++) {
+        const struct Histogram *histogram = &histograms[i];
+
+        g_print ("%-20s %10" G_GUINT64_FORMAT " %10" G_GINT64_FORMAT
+                 " %10" G_GINT64_FORMAT "\n",
+                 histogram->name,
+                 histogram->count,
+                 histogram->count > 0 ? histogram->sum / (gint64) histogram->count : 0,
+                 histogram->max);
+
+        for (j = 0; j < STATS_BUCKETS; j++) {
+            if (histogram->buckets[j] == 0)
+                continue;
+
+            if (j == STATS_BUCKETS - 1)
+                g_print ("    >= %-12" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT "\n",
+                         (guint64) 1 << j, histogram->buckets[j]);
+            else
+                g_print ("    < %-13" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT "\n",
+                         (guint64) 1 << (j + 1), histogram->buckets[j]);
+        }
+    }
+
+    g_print ("%-20s %10s\n", "counter", "value");
+
+    g_variant_iter_init (&iter, values);
+    while (g_variant_iter_next (&iter, "{&st}", &name, &value))
+        g_print ("%-20s %10" G_GUINT64_FORMAT "\n", name, value);
+
+    if (counters[STATS_COUNTER_INPUT_EVENTS] > 0)
+        g_print (
+            "%-20s %10.2f\n",
+            "syscalls/event",
+            counters[STATS_COUNTER_INPUT_SYSCALLS] /
+                (gdouble) counters[STATS_COUNTER_INPUT_EVENTS]
+        );
+}
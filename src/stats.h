@@ -0,0 +1,55 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    /* input_event time to read in handle_events */
+    STATS_STAGE_READ,
+    /* input_event time to headphone-state-changed dispatch */
+    STATS_STAGE_DISPATCH,
+    /* input_event time to fast path mixer write */
+    STATS_STAGE_FAST_VOLUME_SWITCH,
+    /* alsa_volume_switch duration */
+    STATS_STAGE_VOLUME_SWITCH,
+    /* mpris_pause/mpris_play duration */
+    STATS_STAGE_MPRIS_PAUSE,
+    STATS_STAGE_MPRIS_PLAY,
+    /* Pause/Play call to D-Bus reply arrival, per player */
+    STATS_STAGE_MPRIS_REPLY,
+    /* Events construction to first switch devices watched */
+    STATS_STAGE_ATTACH,
+    /* Full /dev/input scan duration */
+    STATS_STAGE_SCAN,
+    STATS_STAGE_LAST
+} StatsStage;
+
+typedef enum {
+    /* Default main context iterations, each one a process wakeup */
+    STATS_COUNTER_LOOP_ITERATIONS,
+    /* Input sources dispatched, evdev and ALSA jacks */
+    STATS_COUNTER_INPUT_WAKEUPS,
+    /* epoll_wait, read and ioctl calls on the evdev path */
+    STATS_COUNTER_INPUT_SYSCALLS,
+    /* input_event structures read */
+    STATS_COUNTER_INPUT_EVENTS,
+    STATS_COUNTER_LAST
+} StatsCounter;
+
+void            stats_record            (StatsStage   stage,
+                                         gint64       elapsed);
+void            stats_count             (StatsCounter counter,
+                                         guint64      count);
+void            stats_watch_main_loop   (void);
+GVariant*       stats_get_counters      (void);
+void            stats_dump              (void);
+
+G_END_DECLS
+
+#endif